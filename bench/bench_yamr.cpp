@@ -0,0 +1,271 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include "map_reduce_runner.h"
+#include "prefix_functors.h"
+#include "prefix_trie.h"
+#include "prefix_approximate.h"
+#include "email_generator.h"
+#include "spill.h"
+#include "lcp.h"
+
+// throughput and memory of prefix algorithms on synthetic emails
+// usage: yamr_bench [generator options] [google benchmark options], e.g. for report which can be compared later:
+//   yamr_bench --count=1000000 --benchmark_format=json --benchmark_out=bench.json
+// generator options are recorded in the context of the report
+
+namespace {
+    struct BenchOptions {
+        synthetic::EmailGeneratorOptions generator;
+        std::string input;   // use this file instead of generated emails
+        mapreduce::OutputFormat output_format = mapreduce::OutputFormat::text;
+        int max_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        bool pin_threads = false;
+    };
+
+    // peak memory is measured for each benchmark separately: high water mark of resident memory is reset before it
+    // (getrusage is not enough here, its maximum can't be reset)
+    void reset_peak_rss() {
+        std::ofstream clear_refs("/proc/self/clear_refs");
+        clear_refs << "5";
+    }
+
+    std::uint64_t peak_rss() {
+        std::ifstream status("/proc/self/status");
+        std::string field;
+        while (status >> field) {
+            if (field == "VmHWM:") {
+                std::uint64_t kilobytes = 0;
+                status >> kilobytes;
+                return kilobytes * 1024;
+            }
+        }
+        return mapreduce::peak_rss_bytes();
+    }
+
+    std::uint64_t count_lines(const std::string& filename) {
+        std::ifstream in(filename);
+        return static_cast<std::uint64_t>(std::count(std::istreambuf_iterator<char>(in),
+                                                     std::istreambuf_iterator<char>(), '\n'));
+    }
+
+    // runs engine created by make_engine(num_threads_map, num_threads_reduce) for each iteration
+    template<typename MakeEngine>
+    void run_engine(benchmark::State& state, std::uint64_t num_records, MakeEngine make_engine) {
+        auto num_threads_map = static_cast<int>(state.range(0));
+        auto num_threads_reduce = static_cast<int>(state.range(1));
+        int result = 0;
+        reset_peak_rss();
+        for (auto _: state) {
+            auto engine = make_engine(num_threads_map, num_threads_reduce);
+            auto results = engine.process();
+            result = results.empty() ? 0 : *std::max_element(results.begin(), results.end());
+            benchmark::DoNotOptimize(result);
+        }
+        state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * num_records));
+        state.counters["records"] = static_cast<double>(num_records);
+        state.counters["peak_rss_bytes"] = benchmark::Counter(static_cast<double>(peak_rss()),
+                                                              benchmark::Counter::kDefaults,
+                                                              benchmark::Counter::kIs1024);
+        state.counters["result"] = result; // answer must not change between releases
+    }
+
+    // 1, 2, 4, ... and max_threads
+    std::vector<std::int64_t> thread_counts(int max_threads) {
+        std::vector<std::int64_t> result;
+        for (int n = 1; n < max_threads; n *= 2)
+            result.push_back(n);
+        result.push_back(max_threads);
+        return result;
+    }
+
+    void register_benchmarks(const std::string& input, std::uint64_t num_records, const std::string& output_dir,
+                             int max_threads, mapreduce::OutputFormat output_format, bool pin_threads) {
+        auto threads = thread_counts(max_threads);
+        const auto& output_path = output_dir;
+        auto add = [&](const std::string& name, auto make_engine) {
+            benchmark::RegisterBenchmark(name.c_str(), [=](benchmark::State& state) {
+                run_engine(state, num_records, make_engine);
+            })->ArgsProduct({threads, threads})->ArgNames({"map", "reduce"})
+                    ->UseRealTime()->Unit(benchmark::kMillisecond);
+        };
+
+        add("prefix", [=](int num_threads_map, int num_threads_reduce) {
+            using namespace prefix;
+            auto runner = mapreduce::MapReduceRunner<PrefixMapper, PrefixReducer>(
+                    input, num_threads_map, num_threads_reduce, output_path);
+            runner.set_output_format(output_format);
+            runner.set_pin_threads(pin_threads);
+            return runner;
+        });
+        add("no_duplicates", [=](int num_threads_map, int num_threads_reduce) {
+            using namespace prefix_no_duplicates;
+            auto runner = mapreduce::MapReduceRunner<PrefixMapper, PrefixReducer, mapreduce::HashPartitioner,
+                    PrefixCombiner>(input, num_threads_map, num_threads_reduce, output_path);
+            runner.set_output_format(output_format);
+            runner.set_pin_threads(pin_threads);
+            return runner;
+        });
+        add("optimized", [=](int num_threads_map, int num_threads_reduce) {
+            using namespace prefix_optimized;
+            auto runner = mapreduce::MapReduceRunner<PrefixMapper, PrefixReducer>(
+                    input, num_threads_map, num_threads_reduce, output_path);
+            runner.set_output_format(output_format);
+            runner.set_pin_threads(pin_threads);
+            return runner;
+        });
+        add("trie", [=](int num_threads_map, int num_threads_reduce) {
+            auto engine = prefix_trie::ShortestPrefixEngine(input, num_threads_map, num_threads_reduce);
+            engine.set_pin_threads(pin_threads);
+            return engine;
+        });
+        add("approximate", [=](int num_threads_map, int num_threads_reduce) {
+            auto engine = prefix_approximate::ApproximatePrefixEngine(input, num_threads_map, num_threads_reduce);
+            engine.set_pin_threads(pin_threads);
+            return engine;
+        });
+    }
+
+    // common prefix kernels on adjacent emails after sorting (as in optimized reducer)
+    void register_lcp_benchmarks(const std::string& input) {
+        auto emails = std::make_shared<std::vector<std::string>>();
+        std::ifstream in(input);
+        std::string email;
+        while (in >> email)
+            emails->push_back(email);
+        std::sort(emails->begin(), emails->end());
+
+        auto add = [&](const std::string& name, lcp::Kernel kernel) {
+            benchmark::RegisterBenchmark(("lcp/" + name).c_str(), [=](benchmark::State& state) {
+                for (auto _: state) {
+                    std::size_t total = 0;
+                    for (std::size_t i = 1; i < emails->size(); i++) {
+                        const auto& prev = (*emails)[i - 1];
+                        const auto& cur = (*emails)[i];
+                        total += kernel(prev.data(), cur.data(), std::min(prev.size(), cur.size()));
+                    }
+                    benchmark::DoNotOptimize(total);
+                }
+                state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * emails->size()));
+            });
+        };
+        add("scalar", lcp::common_prefix_scalar);
+        add("words", lcp::common_prefix_words);
+#ifdef YAMR_LCP_X86
+        add("sse2", lcp::common_prefix_sse2);
+        if (__builtin_cpu_supports("avx2"))
+            add("avx2", lcp::common_prefix_avx2);
+#endif
+    }
+
+    // takes generator options out of argv, so the rest can be parsed by google benchmark
+    bool parse_options(int& argc, char *argv[], BenchOptions& options) {
+        auto& generator = options.generator;
+        int kept = 1;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            auto eq = arg.find('=');
+            auto name = arg.substr(0, eq);
+            auto value = eq == std::string::npos ? std::string() : arg.substr(eq + 1);
+            try {
+                if (name == "--count")
+                    generator.count = std::stoull(value);
+                else if (name == "--min_length")
+                    generator.min_length = std::stoul(value);
+                else if (name == "--max_length")
+                    generator.max_length = std::stoul(value);
+                else if (name == "--length_distribution" && (value == "uniform" || value == "bell"))
+                    generator.length_distribution = value == "uniform" ? synthetic::LengthDistribution::uniform
+                                                                       : synthetic::LengthDistribution::bell;
+                else if (name == "--shared_prefix_depth")
+                    generator.shared_prefix_depth = std::stoul(value);
+                else if (name == "--shared_prefixes")
+                    generator.shared_prefixes = std::stoul(value);
+                else if (name == "--duplicate_ratio")
+                    generator.duplicate_ratio = std::stod(value);
+                else if (name == "--first_letter_skew")
+                    generator.first_letter_skew = std::stod(value);
+                else if (name == "--seed")
+                    generator.seed = std::stoull(value);
+                else if (name == "--input")
+                    options.input = value;
+                else if (name == "--output" && (value == "text" || value == "none"))
+                    options.output_format = value == "text" ? mapreduce::OutputFormat::text
+                                                            : mapreduce::OutputFormat::none;
+                else if (name == "--max_threads")
+                    options.max_threads = std::max(1, std::stoi(value));
+                else if (name == "--pin_threads" && (value == "true" || value == "false"))
+                    options.pin_threads = value == "true";
+                else if (name.rfind("--benchmark_", 0) == 0)
+                    argv[kept++] = argv[i];
+                else
+                    return false;
+            } catch (std::exception&) {
+                return false;
+            }
+        }
+        argc = kept;
+        return true;
+    }
+
+    void print_usage(const char *program) {
+        std::cerr << "Usage: " << program << " [options] [google benchmark options]" << std::endl
+                  << "  --count=N                     number of generated emails (100000)" << std::endl
+                  << "  --min_length=N --max_length=N length of local part (6, 20)" << std::endl
+                  << "  --length_distribution=NAME    uniform (default) or bell" << std::endl
+                  << "  --shared_prefix_depth=N       length of prefixes shared by emails (0)" << std::endl
+                  << "  --shared_prefixes=N           number of different shared prefixes (16)" << std::endl
+                  << "  --duplicate_ratio=X           share of duplicated emails (0)" << std::endl
+                  << "  --first_letter_skew=X         zipf exponent of first letter (0 - uniform)" << std::endl
+                  << "  --seed=N                      seed of generator (1)" << std::endl
+                  << "  --input=FILE                  use emails from file instead of generated ones" << std::endl
+                  << "  --output=FORMAT               output of reducers: text (default) or none" << std::endl
+                  << "  --max_threads=N               maximum number of map and reduce threads (number of cores)"
+                  << std::endl
+                  << "  --pin_threads=BOOL            pin workers to cpus node by node (false)" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options;
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    benchmark::Initialize(&argc, argv);
+
+    mapreduce::TempDirectory work_dir;
+    auto input = options.input;
+    if (input.empty()) {
+        input = work_dir.file("emails.txt");
+        synthetic::EmailGenerator(options.generator).write(input);
+        const auto& generator = options.generator;
+        benchmark::AddCustomContext("count", std::to_string(generator.count));
+        benchmark::AddCustomContext("min_length", std::to_string(generator.min_length));
+        benchmark::AddCustomContext("max_length", std::to_string(generator.max_length));
+        benchmark::AddCustomContext("length_distribution",
+                                    generator.length_distribution == synthetic::LengthDistribution::uniform
+                                    ? "uniform" : "bell");
+        benchmark::AddCustomContext("shared_prefix_depth", std::to_string(generator.shared_prefix_depth));
+        benchmark::AddCustomContext("shared_prefixes", std::to_string(generator.shared_prefixes));
+        benchmark::AddCustomContext("duplicate_ratio", std::to_string(generator.duplicate_ratio));
+        benchmark::AddCustomContext("first_letter_skew", std::to_string(generator.first_letter_skew));
+        benchmark::AddCustomContext("seed", std::to_string(generator.seed));
+    } else {
+        benchmark::AddCustomContext("input", input);
+    }
+
+    register_lcp_benchmarks(input);
+    benchmark::AddCustomContext("output", options.output_format == mapreduce::OutputFormat::text ? "text" : "none");
+    benchmark::AddCustomContext("pin_threads", options.pin_threads ? "true" : "false");
+    register_benchmarks(input, count_lines(input), work_dir.file(""), options.max_threads, options.output_format,
+                        options.pin_threads);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <system_error>
+#include <sched.h>
+#include <pthread.h>
+
+namespace mapreduce {
+    // cpu numbers from list in format of /sys/devices/system/node/node<N>/cpulist, e.g. "0-3,8-11"
+    inline std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> cpus;
+        std::stringstream in(list);
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            auto dash = range.find('-');
+            try {
+                int first = std::stoi(range.substr(0, dash));
+                int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; cpu++)
+                    cpus.push_back(cpu);
+            } catch (std::exception&) {
+                // empty list of node without cpus
+            }
+        }
+        return cpus;
+    }
+
+    // cpus which the process may run on, grouped by NUMA node: workers pinned to cpus in this order fill one node
+    // before the next one, so while there are enough cores on a node, buffers of workers (allocated on first touch,
+    // i.e. on the node of the worker which fills them) and shuffle between them don't cross sockets
+    // without NUMA information allowed cpus are returned in order of numbers
+    inline std::vector<int> cpus_by_node() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return {};
+
+        std::vector<std::pair<int, std::string>> nodes; // number, cpu list
+        std::error_code error;
+        for (const auto& entry: std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+            auto name = entry.path().filename().string();
+            if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+                !std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+                continue;
+            std::ifstream cpulist(entry.path() / "cpulist");
+            std::string list;
+            std::getline(cpulist, list);
+            nodes.emplace_back(std::stoi(name.substr(4)), list);
+        }
+        std::sort(nodes.begin(), nodes.end());
+
+        std::vector<int> cpus;
+        std::vector<char> added(CPU_SETSIZE, false);
+        auto add = [&](int cpu) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed) && !added[cpu]) {
+                added[cpu] = true;
+                cpus.push_back(cpu);
+            }
+        };
+        for (const auto& node: nodes)
+            for (int cpu: parse_cpu_list(node.second))
+                add(cpu);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            add(cpu);
+        return cpus;
+    }
+
+    // binds thread to one cpu, returns false if it fails (e.g. cpu is not allowed or doesn't exist)
+    inline bool pin_thread(pthread_t thread, int cpu) {
+        if (cpu < 0 || cpu >= CPU_SETSIZE)
+            return false;
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        return pthread_setaffinity_np(thread, sizeof(cpus), &cpus) == 0;
+    }
+}
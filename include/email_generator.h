@@ -0,0 +1,138 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <cstdint>
+#include "random.h"
+
+namespace synthetic {
+    // deterministic generator of synthetic email addresses for benchmarks
+    // the same options give the same addresses on every platform: only own random generator is used
+    // (distributions of standard library differ between implementations)
+
+    // address i is generated from seed and i alone
+    using mapreduce::SplitMix64;
+
+    enum class LengthDistribution {
+        uniform, // all lengths in [min_length, max_length] are equally likely
+        bell     // sum of 4 uniform values: most lengths are near the middle of [min_length, max_length]
+    };
+
+    struct EmailGeneratorOptions {
+        std::uint64_t count = 100000;
+        // length of the local part (before '@')
+        std::size_t min_length = 6;
+        std::size_t max_length = 20;
+        LengthDistribution length_distribution = LengthDistribution::uniform;
+        // local part starts with first letter and one of shared_prefixes random strings of this length,
+        // so with enough addresses shortest unique prefix is longer than shared_prefix_depth + 1
+        // (0 - no shared prefixes)
+        std::size_t shared_prefix_depth = 0;
+        std::size_t shared_prefixes = 16;
+        // probability that address repeats one of previous addresses
+        double duplicate_ratio = 0;
+        // exponent of zipf distribution of the first letter (0 - all letters are equally likely)
+        double first_letter_skew = 0;
+        std::uint64_t seed = 1;
+    };
+
+    class EmailGenerator {
+    public:
+        explicit EmailGenerator(const EmailGeneratorOptions& options_) : options(options_) {
+            if (options.min_length == 0 || options.min_length > options.max_length)
+                throw std::invalid_argument("email length must satisfy 0 < min_length <= max_length");
+            if (options.shared_prefix_depth > 0 && options.shared_prefixes == 0)
+                throw std::invalid_argument("number of shared prefixes must be positive");
+
+            double total = 0;
+            for (std::size_t i = 0; i < symbols.size(); i++) {
+                total += 1.0 / std::pow(static_cast<double>(i + 1), options.first_letter_skew);
+                first_letter_cdf.push_back(total);
+            }
+            for (auto& value: first_letter_cdf)
+                value /= total;
+
+            SplitMix64 random(options.seed);
+            for (std::size_t i = 0; i < options.shared_prefixes && options.shared_prefix_depth > 0; i++) {
+                shared.emplace_back();
+                for (std::size_t k = 0; k < options.shared_prefix_depth; k++)
+                    shared.back() += symbols[random.below(symbols.size())];
+            }
+        }
+
+        std::uint64_t size() const {
+            return options.count;
+        }
+
+        // address number idx
+        std::string operator()(std::uint64_t idx) const {
+            // duplicate repeats earlier record, if that one is a duplicate too, the record it repeats and so on
+            while (idx > 0) {
+                SplitMix64 random(mix(idx) ^ 0x5bd1e995ull);
+                if (random.uniform() >= options.duplicate_ratio)
+                    break;
+                idx = random.below(idx);
+            }
+            return unique_address(idx);
+        }
+
+        // writes all addresses, one per line
+        void write(std::ostream& out) const {
+            for (std::uint64_t i = 0; i < options.count; i++)
+                out << (*this)(i) << '\n';
+        }
+
+        void write(const std::string& filename) const {
+            std::ofstream out(filename);
+            write(out);
+            if (!out)
+                throw std::runtime_error("can't write emails to " + filename);
+        }
+
+    private:
+        static constexpr std::string_view symbols = "abcdefghijklmnopqrstuvwxyz0123456789";
+        static constexpr std::string_view domains[] = {"gmail.com", "yahoo.com", "yandex.ru", "mail.ru",
+                                                       "outlook.com", "example.org"};
+
+        EmailGeneratorOptions options;
+        std::vector<double> first_letter_cdf;
+        std::vector<std::string> shared;
+
+        std::uint64_t mix(std::uint64_t idx) const {
+            return SplitMix64(options.seed ^ (idx * 0xd1b54a32d192ed03ull)).next();
+        }
+
+        std::size_t local_length(SplitMix64& random) const {
+            auto range = options.max_length - options.min_length + 1;
+            if (options.length_distribution == LengthDistribution::uniform)
+                return options.min_length + random.below(range);
+            double sum = 0;
+            for (int i = 0; i < 4; i++)
+                sum += random.uniform();
+            return options.min_length + std::min<std::size_t>(range - 1, static_cast<std::size_t>(sum / 4 * range));
+        }
+
+        std::string unique_address(std::uint64_t idx) const {
+            SplitMix64 random(mix(idx));
+            auto length = local_length(random);
+            std::string address;
+            address.reserve(length + 12);
+            auto letter = std::upper_bound(first_letter_cdf.begin(), first_letter_cdf.end(), random.uniform());
+            address += symbols[std::min<std::size_t>(letter - first_letter_cdf.begin(), symbols.size() - 1)];
+            if (!shared.empty())
+                address += shared[random.below(shared.size())];
+            while (address.size() < length)
+                address += symbols[random.below(symbols.size())];
+            address += '@';
+            address += domains[random.below(std::size(domains))];
+            return address;
+        }
+    };
+}
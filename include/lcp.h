@@ -0,0 +1,117 @@
+#pragma once
+
+#include <string_view>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YAMR_LCP_X86 1
+#include <immintrin.h>
+#endif
+
+namespace lcp {
+    // length of the longest common prefix of two strings
+    // vectorized kernels compare 16 (sse2) or 32 (avx2) bytes per step, the best one supported by cpu is chosen
+    // at runtime, so the binary doesn't need to be built with -mavx2
+
+    // byte by byte, reference for other kernels
+    inline std::size_t common_prefix_scalar(const char *lhs, const char *rhs, std::size_t size) {
+        std::size_t i = 0;
+        while (i < size && lhs[i] == rhs[i])
+            i++;
+        return i;
+    }
+
+    // 8 bytes per step, used for tails of vectorized kernels and when there are no vector instructions
+    inline std::size_t common_prefix_words(const char *lhs, const char *rhs, std::size_t size) {
+        std::size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            std::uint64_t a, b;
+            std::memcpy(&a, lhs + i, 8);
+            std::memcpy(&b, rhs + i, 8);
+            if (a != b) // little endian: the first different byte is the lowest one
+                return i + static_cast<std::size_t>(__builtin_ctzll(a ^ b)) / 8;
+        }
+        return i + common_prefix_scalar(lhs + i, rhs + i, size - i);
+    }
+
+#ifdef YAMR_LCP_X86
+    // loads never go past the end of strings: tail shorter than vector is compared with one load of the last
+    // vector of the strings, which overlaps already compared (equal) bytes, so the first difference in it
+    // is the first difference of the strings; strings shorter than vector are compared by words
+
+    __attribute__((target("sse2")))
+    inline std::size_t common_prefix_sse2(const char *lhs, const char *rhs, std::size_t size) {
+        if (size < 16)
+            return common_prefix_words(lhs, rhs, size);
+        std::size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs + i));
+            auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + i));
+            auto equal = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+            if (equal != 0xffffu)
+                return i + static_cast<std::size_t>(__builtin_ctz(~equal));
+        }
+        if (i < size) {
+            i = size - 16;
+            auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs + i));
+            auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs + i));
+            auto equal = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+            if (equal != 0xffffu)
+                return i + static_cast<std::size_t>(__builtin_ctz(~equal));
+        }
+        return size;
+    }
+
+    __attribute__((target("avx2")))
+    inline std::size_t common_prefix_avx2(const char *lhs, const char *rhs, std::size_t size) {
+        // adjacent sorted emails usually differ in the first bytes: short strings and the first 16 bytes
+        // are checked with cheaper 16 bytes loads
+        if (size < 32)
+            return common_prefix_sse2(lhs, rhs, size);
+        auto first_a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lhs));
+        auto first_b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs));
+        auto first_equal = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(first_a, first_b)));
+        if (first_equal != 0xffffu)
+            return static_cast<std::size_t>(__builtin_ctz(~first_equal));
+        std::size_t i = 16;
+        for (; i + 32 <= size; i += 32) {
+            auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lhs + i));
+            auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rhs + i));
+            auto equal = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+            if (equal != 0xffffffffu)
+                return i + static_cast<std::size_t>(__builtin_ctz(~equal));
+        }
+        if (i < size) {
+            i = size - 32;
+            auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(lhs + i));
+            auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rhs + i));
+            auto equal = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+            if (equal != 0xffffffffu)
+                return i + static_cast<std::size_t>(__builtin_ctz(~equal));
+        }
+        return size;
+    }
+#endif
+
+    using Kernel = std::size_t (*)(const char *, const char *, std::size_t);
+
+    // the best kernel for this cpu
+    inline Kernel best_kernel() {
+#ifdef YAMR_LCP_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return common_prefix_avx2;
+        if (__builtin_cpu_supports("sse2"))
+            return common_prefix_sse2;
+#endif
+        return common_prefix_words;
+    }
+
+    inline std::size_t common_prefix_length(std::string_view lhs, std::string_view rhs) {
+        static const Kernel kernel = best_kernel();
+        return kernel(lhs.data(), rhs.data(), std::min(lhs.size(), rhs.size()));
+    }
+}
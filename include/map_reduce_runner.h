@@ -6,204 +6,695 @@
 #include <thread>
 #include <chrono>
 #include <algorithm>
-#include <future>
 #include <limits>
+#include <stdexcept>
 #include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string_view>
+#include <type_traits>
+#include "mapped_file.h"
+#include "partitioners.h"
+#include "spill.h"
+#include "sorted_runs.h"
+#include "thread_pool.h"
+#include "string_arena.h"
+#include "runner_stats.h"
+#include "string_sort.h"
+#include "output_sink.h"
+#include "map_traits.h"
 
 namespace mapreduce {
-    template<typename MapCls, typename ReduceCls>
+    // how mappers read the input file:
+    // - mmap: file is memory mapped and split into byte ranges aligned to lines, records are string_views to mapping
+    // - stream: each mapper reads its lines with std::ifstream (works for files which can't be mapped)
+    enum class InputMode {
+        mmap,
+        stream
+    };
+
+    // default combiner: map results are passed to shuffle as is
+    struct NoCombiner {
+    };
+
+    // folds runs of equal keys in sorted bucket to one pair (in place)
+    template<typename CombineCls, typename Pair>
+    void combine_sorted(std::vector<Pair>& bucket) {
+        CombineCls combiner{};
+        size_t last = 0;
+        for (size_t i = 1; i < bucket.size(); i++) {
+            if (bucket[i].first == bucket[last].first)
+                combiner(bucket[last].first, bucket[last].second, std::move(bucket[i].second));
+            else if (++last != i)
+                bucket[last] = std::move(bucket[i]);
+        }
+        if (!bucket.empty())
+            bucket.resize(last + 1);
+        bucket.shrink_to_fit();
+    }
+
+    // reducer of a partition: constructed from OutputSink& or (legacy reducers) from name of output file
+    template<typename ReduceCls>
+    ReduceCls make_reducer(OutputSink *sink, const std::string& output_path) {
+        if constexpr (std::is_constructible_v<ReduceCls, OutputSink&>)
+            return ReduceCls(*sink);
+        else
+            return ReduceCls(output_path + ".txt");
+    }
+
+    // runs reducer for sorted run, groups data by key while reading
+    // output goes to output_path with extension of output_format, returns false if run is empty
+    template<typename ReduceCls, typename Pair, typename Result>
+    bool reduce_sorted_run(SortedRun<Pair>& run, const std::string& output_path, OutputFormat output_format,
+                           Result& result, ReduceTaskStats& task_stats) {
+        using key_t = typename Pair::first_type;
+        using value_t = typename Pair::second_type;
+        KeyGroups<Pair> groups(run);
+        if (!groups.next_key())
+            return false;
+
+        std::unique_ptr<OutputSink> sink; // declared before reducer: reducer refers to it until destruction
+        if constexpr (std::is_constructible_v<ReduceCls, OutputSink&>)
+            sink = make_output_sink(output_format, output_path);
+        auto reducer = make_reducer<ReduceCls>(sink.get(), output_path);
+        std::vector<value_t> values;
+        std::chrono::steady_clock::duration reduce_call_time{};
+        do {
+            auto group_values = groups.values();
+            auto reduce_call_start = std::chrono::steady_clock::now();
+            if constexpr (std::is_invocable_v<ReduceCls&, const key_t&, GroupValues<Pair>&>) {
+                result = reducer(groups.key(), group_values);
+            } else {
+                // adapter for reducers which take std::vector of values: group is collected in memory
+                values.clear();
+                for (auto& value: group_values)
+                    values.emplace_back(std::move(value));
+                result = reducer(groups.key(), std::move(values));
+            }
+            reduce_call_time += std::chrono::steady_clock::now() - reduce_call_start;
+
+            auto group_size = groups.finish_group();
+            task_stats.keys++;
+            task_stats.pairs += group_size;
+            add_to_histogram(task_stats.key_group_histogram, group_size);
+        } while (groups.next_key());
+        task_stats.reduce_call_seconds = std::chrono::duration<double>(reduce_call_time).count();
+        if (sink)
+            sink->close(); // output is incomplete if it throws (e.g. disk is full)
+        return true;
+    }
+
+    // PartitionCls chooses reducer for each key (see partitioners.h):
+    // mappers write directly to per-reducer buckets, each reducer merges only its own buckets
+    // CombineCls (optional) folds values with equal keys in each mapper bucket after sorting:
+    // void operator()(const key_t& key, value_t& accumulated, value_t&& value)
+    template<typename MapCls, typename ReduceCls,
+            typename PartitionCls = HashPartitioner,
+            typename CombineCls = NoCombiner>
     class MapReduceRunner {
     public:
-        using map_result_t = typename decltype(std::declval<MapCls>()("", ""))::value_type; // vector -> value_type
-        using map_value_t = typename decltype(std::declval<MapCls>()("", ""))::value_type::second_type;
-        // vector<pair> -> second_type is value
-        using reduce_result_t = decltype(std::declval<ReduceCls>()("", {}));
+        // pair emitted by mapper (sink mappers declare it, others return vector of pairs, see map_traits.h)
+        using map_result_t = typename MapTraits<MapCls>::pair_t;
+        using map_key_t = typename map_result_t::first_type;
+        using map_value_t = typename map_result_t::second_type;
+
+        // reducer can take values of a key in two ways:
+        // - streaming: operator()(const key_t& key, GroupValues<pair>& values) - values are read while iterating
+        // - operator()(const key_t& key, std::vector<value_t> values) - all values of a key are collected first
+        using group_values_t = GroupValues<map_result_t>;
+        static constexpr bool streaming_reducer =
+                std::is_invocable_v<ReduceCls&, const map_key_t&, group_values_t&>;
+        using reduce_result_t = typename std::conditional_t<
+                streaming_reducer,
+                std::invoke_result<ReduceCls&, const map_key_t&, group_values_t&>,
+                std::invoke_result<ReduceCls&, const map_key_t&, std::vector<map_value_t>&&>>::type;
 
 
         MapReduceRunner(
                 std::string filename_,
                 int num_threads_map_,
                 int num_threads_reduce_,
-                std::string path_to_save_reduce_files_ = "") :
+                std::string path_to_save_reduce_files_ = "",
+                InputMode input_mode_ = InputMode::mmap) :
                 filename(std::move(filename_)),
                 num_threads_map(num_threads_map_),
                 num_threads_reduce(num_threads_reduce_),
                 path_to_save_reduce_files(std::move(path_to_save_reduce_files_)),
-                map_results(static_cast<size_t>(num_threads_map_)) {}
+                input_mode(input_mode_) {}
+
+        // runner uses its own pool with max(num_threads_map, num_threads_reduce) workers by default,
+        // pool can be shared between runners (its workers are pinned or not by its constructor,
+        // set_pin_threads doesn't change them)
+        void set_thread_pool(std::shared_ptr<ThreadPool> thread_pool_) {
+            thread_pool = std::move(thread_pool_);
+        }
+
+        // map input is split into num_threads_map * tasks_per_thread tasks, so idle workers can take tasks
+        // of slow ones; reduce keys are split into num_threads_reduce partitions, each of them is reduced
+        // by one task which writes its own file (reduce_0 .. reduce_<num_threads_reduce - 1>)
+        void set_tasks_per_thread(int tasks_per_thread_) {
+            tasks_per_thread = std::max(tasks_per_thread_, 1);
+        }
+
+        // output of reducers constructed from OutputSink& (reducers constructed from file name write
+        // "reduce_<N>.txt" themselves)
+        void set_output_format(OutputFormat output_format_) {
+            output_format = output_format_;
+        }
+
+        // limits memory for map results of each mapper (approximately, in bytes):
+        // when limit is exceeded, sorted buckets are spilled as run files to temporary directory in spill_path_
+        // (system temporary directory by default), 0 - no limit
+        void set_memory_budget(std::size_t memory_budget_per_mapper, std::string spill_path_ = "") {
+            memory_budget = memory_budget_per_mapper;
+            spill_path = std::move(spill_path_);
+        }
+
+        // pipelined mode: phases are not separated by barriers, sorted runs of finished map tasks are merged
+        // while other map tasks are running, and reduce task of a partition starts as soon as all its runs
+        // are ready (statistics have one "pipeline" phase instead of map, shuffle and reduce)
+        void set_pipelined(bool pipelined_) {
+            pipelined = pipelined_;
+        }
+
+        // workers of the runner's own pool are pinned to cpus, filling one NUMA node before the next one
+        // (see ThreadPool), state of map tasks is allocated by their workers in any case;
+        // ignored when pool is given by set_thread_pool or was created by a previous process() call
+        void set_pin_threads(bool pin_threads_) {
+            pin_threads = pin_threads_;
+        }
 
         // main function: map + shuffle + reduce
         std::vector<reduce_result_t> process() {
-            run_map();
-            run_shuffle();
-            run_reduce();
+            if (!thread_pool)
+                thread_pool = std::make_shared<ThreadPool>(std::max(num_threads_map, num_threads_reduce), pin_threads);
+            run_stats = RunnerStats();
+            run_stats.unpinned_workers = thread_pool->pinning_failures();
+            partitions.clear();
+            partitions.resize(static_cast<size_t>(num_threads_reduce));
+
+            if (pipelined) {
+                run_phase("pipeline", [this] { this->run_pipeline(); });
+            } else {
+                run_phase("map", [this] { this->run_map(); });
+                run_phase("shuffle", [this] { this->run_shuffle(); });
+                run_phase("reduce", [this] { this->run_reduce(); });
+            }
+            run_stats.peak_rss_bytes = peak_rss_bytes();
             return reduce_results;
         }
 
+        // statistics of the last process() call
+        const RunnerStats& stats() const {
+            return run_stats;
+        }
+
     private:
         int num_threads_map;
         int num_threads_reduce;
 
         const std::string filename;
         const std::string path_to_save_reduce_files;
+        const InputMode input_mode;
+
+        std::shared_ptr<ThreadPool> thread_pool;
+        int tasks_per_thread = 4;
+        OutputFormat output_format = OutputFormat::text;
+        bool pipelined = false;
+        bool pin_threads = false;
 
-        std::vector<int> lines_indices;
+        // input records: map results may refer to them (e.g. std::string_view keys and values),
+        // so they live until the end of reduce
+        // mmap mode: records point into mapped file, stream mode: records are copied to arena of map task
+        std::unique_ptr<MappedFile> mapped_file;
+        std::uint64_t input_size = 0;
+
+        // state of a map task, it is allocated by the worker which runs the task: its buffers are touched first
+        // by this worker (with pinned threads they are placed on its NUMA node) and counters of different tasks
+        // don't share cache lines
+        // buckets are packed when mapper has pack_size pairs and when it is done
+        static constexpr std::size_t pack_size = 1 << 20;
+        struct alignas(64) MapTask {
+            // buckets[partition]: map results for reducer
+            std::vector<std::vector<map_result_t>> buckets;
+            // packed_runs[partition]: sorted runs of bucket packed to bytes (see packed_pairs.h)
+            std::vector<std::vector<std::vector<char>>> packed_runs;
+            // spilled_runs[partition]: run files in order of spilling
+            std::vector<std::vector<std::string>> spilled_runs;
+            std::size_t buffered_pairs = 0;
+            std::size_t buffered_bytes = 0;
+            StringArena records; // stream mode: copies of input records
+            MapTaskStats stats;
+
+            explicit MapTask(std::size_t num_partitions) :
+                    buckets(num_partitions), packed_runs(num_partitions), spilled_runs(num_partitions) {}
+        };
+        std::vector<std::unique_ptr<MapTask>> map_tasks;
+        // partitions[reducer]: streaming merge of sorted runs of all mappers
+        std::vector<std::unique_ptr<SortedRun<map_result_t>>> partitions;
 
-        std::vector<std::vector<map_result_t>> map_results;
-        std::vector<map_result_t> map_results_flat;
+        // spilling map results to disk: 0 means no memory limit
+        std::size_t memory_budget = 0;
+        std::string spill_path;
+        std::unique_ptr<TempDirectory> spill_directory;
 
-        // usefull struct to prepare data for reduce
-        struct ReducerData {
-            std::string key;
-            std::vector<map_value_t> values;
+        // sorted runs of map tasks [first_task, last_task] for a partition
+        using run_ptr_t = std::unique_ptr<SortedRun<map_result_t>>;
+        struct RunGroup {
+            std::size_t first_task;
+            std::size_t last_task;
+            std::vector<run_ptr_t> runs;
+            bool in_memory; // no spilled runs: group can be merged to one packed run
         };
 
-        std::vector<ReducerData> data_for_reducer;
+        // pipelined mode: run groups of each partition which are ready, ordered by first_task
+        struct PipelinePartition {
+            std::mutex mutex;
+            std::vector<RunGroup> groups;
+            int merges_running = 0;
+            bool reduce_started = false;
+        };
+        struct Pipeline {
+            explicit Pipeline(std::size_t num_partitions, std::size_t num_map_tasks) :
+                    partitions(num_partitions), map_tasks_waiting(num_map_tasks), map_tasks_mapping(num_map_tasks),
+                    map_tasks_running(num_map_tasks) {}
+
+            std::vector<PipelinePartition> partitions;
+            std::atomic<std::size_t> map_tasks_waiting; // not started
+            std::atomic<std::size_t> map_tasks_mapping; // map function is called or will be called
+            std::atomic<std::size_t> map_tasks_running; // runs are not added to partitions yet
+            std::atomic<std::size_t> merges_running{0};
+        };
+        std::unique_ptr<Pipeline> pipeline;
+
+        std::vector<reduce_result_t> results_by_partition;
+        std::vector<char> has_result;
         std::vector<reduce_result_t> reduce_results;
+        RunnerStats run_stats;
+
 
+        template<typename Func>
+        void run_phase(const std::string& name, Func func) {
+            Stopwatch stopwatch;
+            func();
+            run_stats.phases.push_back({name, stopwatch.wall_seconds(), stopwatch.cpu_seconds()});
+        }
 
         void run_map() {
-            // reading file to get "\n" symbols position to split data for mapper
-            std::ifstream infile(filename);
-            std::string buf;
-            lines_indices.push_back(0);
-            while (std::getline(infile, buf)) {
-                auto position = infile.tellg();
-                if (position >= 0)
-                    lines_indices.emplace_back(position);
-                else
-                    break;
+            auto num_tasks = split_input();
+            thread_pool->parallel_for(num_tasks, [this](std::size_t i) { this->run_map_task(i); });
+        }
+
+        // opens input and prepares containers of map tasks, returns number of map tasks
+        // input is split into equal byte ranges, each map task aligns its range to lines itself,
+        // so there is no serial pass over the whole file before mapping
+        std::size_t split_input() {
+            if (memory_budget > 0)
+                spill_directory = std::make_unique<TempDirectory>(spill_path);
+
+            run_phase("split", [this] {
+                if (input_mode == InputMode::mmap) {
+                    mapped_file = std::make_unique<MappedFile>(filename);
+                    input_size = mapped_file->view().size();
+                } else {
+                    std::ifstream infile(filename, std::ios::binary | std::ios::ate);
+                    if (!infile)
+                        throw std::runtime_error("can't open " + filename);
+                    input_size = static_cast<std::uint64_t>(infile.tellg());
+                }
+            });
+            auto num_tasks = std::min<std::uint64_t>(static_cast<std::uint64_t>(num_threads_map) * tasks_per_thread,
+                                                     std::max<std::uint64_t>(input_size, 1));
+            prepare_map_tasks(num_tasks);
+            return num_tasks;
+        }
+
+        // slots for state of each map task (it is allocated by the task itself)
+        void prepare_map_tasks(std::size_t num_tasks) {
+            map_tasks.clear();
+            map_tasks.resize(num_tasks);
+            run_stats.map_tasks.assign(num_tasks, MapTaskStats());
+        }
+
+        // runs map task in thread pool and saves its time
+        // mmap: records point into mapped file, stream: task reads its range with its own stream,
+        // reading only a block around range boundaries to find line starts
+        void run_map_task(std::size_t task_idx) {
+            Stopwatch stopwatch(CLOCK_THREAD_CPUTIME_ID);
+            map_tasks[task_idx] = std::make_unique<MapTask>(partitions.size());
+            auto num_tasks = map_tasks.size();
+            auto range_start = input_size * task_idx / num_tasks;
+            auto range_end = input_size * (task_idx + 1) / num_tasks;
+            if (input_mode == InputMode::mmap) {
+                auto data = mapped_file->view();
+                run_single_mapper_mmap(data, align_to_line_start(data, range_start),
+                                       align_to_line_start(data, range_end), static_cast<int>(task_idx));
+            } else {
+                std::ifstream file(filename, std::ios::binary);
+                auto start = align_to_line_start(file, range_start, input_size);
+                auto end = align_to_line_start(file, range_end, input_size);
+                run_single_mapper(file, static_cast<std::streamoff>(start), static_cast<std::streamoff>(end),
+                                  static_cast<int>(task_idx));
             }
-            infile.close();
-            lines_indices.push_back(std::numeric_limits<int>::max());
-
-            auto total_blocks = static_cast<int>(lines_indices.size()) - 1;
-            auto num_threads = std::min(num_threads_map, total_blocks);
-            double step = static_cast<double>(total_blocks) / num_threads; // step >= 1 always
-            std::vector<std::thread> map_threads;
-            for (int i = 0, j = 0, j_next = 0; i < num_threads; i++) {
-                j = j_next;
-                if (i == num_threads - 1)
-                    j_next = total_blocks;
-                else
-                    j_next = static_cast<int>(step * (i + 1));
-
-                map_threads.emplace_back([this, j, j_next, i] {
-                    this->run_single_mapper(lines_indices[j], lines_indices[j_next], i);
-                });
+            auto& task_stats = map_tasks[task_idx]->stats;
+            task_stats.worker = thread_pool->worker_index();
+            task_stats.wall_seconds = stopwatch.wall_seconds();
+            task_stats.cpu_seconds = stopwatch.cpu_seconds();
+            run_stats.map_tasks[task_idx] = task_stats;
+        }
+
+
+        // runs reduce tasks in thread pool: each task reads its own merged partition
+        // and calls reduce function for each key
+        void run_reduce() {
+            prepare_reduce_tasks();
+            thread_pool->parallel_for(partitions.size(), [this](std::size_t i) { this->run_reduce_task(i); });
+            finish_reduce();
+        }
+
+        void prepare_reduce_tasks() {
+            results_by_partition.assign(partitions.size(), reduce_result_t());
+            has_result.assign(partitions.size(), false);
+            run_stats.reduce_tasks.assign(partitions.size(), ReduceTaskStats());
+        }
+
+        void run_reduce_task(std::size_t partition_idx) {
+            Stopwatch stopwatch(CLOCK_THREAD_CPUTIME_ID);
+            auto& task_stats = run_stats.reduce_tasks[partition_idx];
+            has_result[partition_idx] = run_single_reducer(static_cast<int>(partition_idx),
+                                                           results_by_partition[partition_idx], task_stats);
+            partitions[partition_idx].reset();
+            task_stats.worker = thread_pool->worker_index();
+            task_stats.wall_seconds = stopwatch.wall_seconds();
+            task_stats.cpu_seconds = stopwatch.cpu_seconds();
+        }
+
+        // collects results and statistics of reduce tasks, frees input
+        void finish_reduce() {
+            for (const auto& task_stats: run_stats.reduce_tasks) {
+                auto& histogram = run_stats.key_group_histogram;
+                if (histogram.size() < task_stats.key_group_histogram.size())
+                    histogram.resize(task_stats.key_group_histogram.size(), 0);
+                for (size_t k = 0; k < task_stats.key_group_histogram.size(); k++)
+                    histogram[k] += task_stats.key_group_histogram[k];
             }
 
-            for (auto& t: map_threads)
-                t.join();
+            // empty partitions have no reducer and no result
+            reduce_results.clear();
+            for (size_t i = 0; i < partitions.size(); i++)
+                if (has_result[i])
+                    reduce_results.push_back(std::move(results_by_partition[i]));
+            results_by_partition.clear();
+
+            spill_directory.reset();
+            map_tasks.clear();
+            mapped_file.reset();
         }
 
+        // runs reducer for sorted partition, writes result for separated container, so there is no need to use mutex
+        // returns false if partition is empty
+        bool run_single_reducer(int partition_idx, reduce_result_t& result, ReduceTaskStats& task_stats) {
+            auto output_path = path_to_save_reduce_files + "reduce_" + std::to_string(partition_idx);
+            return reduce_sorted_run<ReduceCls>(*partitions[partition_idx], output_path, output_format, result,
+                                                task_stats);
+        }
 
-        // groups data by key for reducer and run in threads reduce function
-        void run_reduce() {
-            // grouping data (by key) for reducer: map_results_flat is sorted
-            int last_j = -1;
-            for (const auto& elem: map_results_flat) {
-                if (last_j == -1 || data_for_reducer[last_j].key != elem.first) {
-                    data_for_reducer.push_back({elem.first, {elem.second}});
-                    last_j++;
-                } else {
-                    data_for_reducer[last_j].values.emplace_back(elem.second);
+        // prepares streaming merge of sorted runs of all mappers for each partition
+        void run_shuffle() {
+            for (size_t i = 0; i < partitions.size(); i++) {
+                std::vector<run_ptr_t> runs;
+                for (size_t j = 0; j < map_tasks.size(); j++)
+                    take_runs(j, i, runs);
+                partitions[i] = std::make_unique<MergedRuns<map_result_t>>(std::move(runs));
+            }
+        };
+
+        // appends sorted runs of map task for partition to runs in order of their creation:
+        // spilled runs are read from disk, packed buckets are moved without copying
+        void take_runs(std::size_t map_task, std::size_t partition_idx, std::vector<run_ptr_t>& runs) {
+            auto& task = *map_tasks[map_task];
+            for (const auto& run_filename: task.spilled_runs[partition_idx])
+                runs.emplace_back(std::make_unique<FileRun<map_result_t>>(run_filename));
+            for (auto& packed: task.packed_runs[partition_idx])
+                runs.emplace_back(std::make_unique<PackedRun<map_result_t>>(std::move(packed)));
+            task.packed_runs[partition_idx] = {};
+            task.spilled_runs[partition_idx].clear();
+        }
+
+        // map, merge and reduce tasks in one task group, each task starts the tasks which became ready after it:
+        // - finished map task adds its runs to groups of ready runs of each partition
+        // - two ready groups of a partition are merged to one packed run by workers which would wait otherwise:
+        //   when all map tasks are started and some of them are still running, so reduce tasks merge fewer runs
+        // - reduce task of a partition starts when all map tasks are done and its merges are finished
+        // reduce can't start earlier: any map task can emit the smallest key of a partition
+        void run_pipeline() {
+            auto num_tasks = split_input();
+            prepare_reduce_tasks();
+            pipeline = std::make_unique<Pipeline>(partitions.size(), num_tasks);
+
+            TaskGroup tasks(*thread_pool);
+            for (std::size_t j = 0; j < num_tasks; j++) {
+                tasks.run([this, &tasks, j] {
+                    pipeline->map_tasks_waiting--;
+                    this->run_map_task(j);
+                    pipeline->map_tasks_mapping--;
+                    this->finish_pipelined_map_task(tasks, j);
+                });
+            }
+            tasks.wait();
+            pipeline.reset();
+            finish_reduce();
+        }
+
+        void finish_pipelined_map_task(TaskGroup& tasks, std::size_t map_task) {
+            auto& running = pipeline->map_tasks_running;
+            for (size_t i = 0; i < partitions.size(); i++) {
+                RunGroup group{map_task, map_task, {}, map_tasks[map_task]->spilled_runs[i].empty()};
+                take_runs(map_task, i, group.runs);
+                auto& partition = pipeline->partitions[i];
+                std::lock_guard<std::mutex> lock(partition.mutex);
+                add_run_group(partition, std::move(group));
+                start_merges(tasks, i);
+            }
+            // counter is decremented after runs are added: the last map task sees runs of all tasks
+            if (--running == 0) {
+                for (size_t i = 0; i < partitions.size(); i++) {
+                    std::lock_guard<std::mutex> lock(pipeline->partitions[i].mutex);
+                    start_reduce_if_ready(tasks, i);
                 }
             }
+        }
+
+        static void add_run_group(PipelinePartition& partition, RunGroup&& group) {
+            auto position = std::find_if(partition.groups.begin(), partition.groups.end(), [&](const RunGroup& other) {
+                return other.first_task > group.first_task;
+            });
+            partition.groups.insert(position, std::move(group));
+        }
 
-            auto num_threads = std::min(num_threads_reduce, static_cast<int>(data_for_reducer.size()));
-            reduce_results = std::vector<reduce_result_t>(num_threads, reduce_result_t());
-
-            std::vector<std::thread> reduce_threads;
-            auto total_blocks = static_cast<int>(data_for_reducer.size());
-            double step = static_cast<double>(total_blocks) / num_threads; // step >= 1
-            for (int i = 0, j = 0, j_next = 0; i < num_threads; i++) {
-                j = j_next;
-                if (i == num_threads - 1)
-                    j_next = total_blocks;
-                else
-                    j_next = static_cast<int>(step * (i + 1));
-                reduce_threads.emplace_back([this, j, j_next, i] {
-                    this->run_single_reducer(j, j_next, i);
+        // merges neighbouring groups of the same number of map tasks (like a binary counter, so each pair
+        // is merged at most log(number of map tasks) times); unless reducer is order insensitive,
+        // only groups of consecutive map tasks are merged, so equal keys keep order of map tasks
+        // called under lock of partition
+        void start_merges(TaskGroup& tasks, std::size_t partition_idx) {
+            auto& partition = pipeline->partitions[partition_idx];
+            auto& groups = partition.groups;
+            for (size_t k = 0; k + 1 < groups.size() && has_idle_worker();) {
+                auto& first = groups[k];
+                auto& second = groups[k + 1];
+                bool mergeable = first.in_memory && second.in_memory &&
+                                 first.last_task - first.first_task == second.last_task - second.first_task &&
+                                 (ReduceTraits<ReduceCls>::order_insensitive ||
+                                  first.last_task + 1 == second.first_task);
+                if (!mergeable) {
+                    k++;
+                    continue;
+                }
+                // std::function needs copyable tasks: groups are moved to shared pointer
+                auto merging = std::make_shared<std::pair<RunGroup, RunGroup>>(std::move(first), std::move(second));
+                groups.erase(groups.begin() + k, groups.begin() + k + 2);
+                partition.merges_running++;
+                pipeline->merges_running++;
+                tasks.run([this, &tasks, partition_idx, merging] {
+                    this->merge_run_groups(tasks, partition_idx, std::move(merging->first),
+                                           std::move(merging->second));
                 });
             }
-            for (auto& t: reduce_threads)
-                t.join();
-        }
-
-        // runs reducer
-        // writes result for separated container, so there is no need to use mutex
-        void run_single_reducer(int start_i, int end_i, int thread_idx) {
-            ReduceCls reducer(path_to_save_reduce_files + "reduce_" + std::to_string(thread_idx) + ".txt");
-            for (int i = start_i; i < end_i; i++)
-                reduce_results[thread_idx] = reducer(data_for_reducer[i].key, data_for_reducer[i].values);
-        }
-
-        // async merge sort for sorted map results,
-        // will work in not more than num_threads_map threads,
-        // because: num_threads_map / 2 + num_threads_map / 4 + ... + 1 etc <= num_threads_map
-        std::vector<map_result_t> merge_map_results(int i, int j) {
-            assert(i <= j);
-            if (i == j)
-                return map_results[i];
-
-            std::vector<map_result_t> result1;
-            std::vector<map_result_t> result2;
-            if (i + 1 == j) {
-                result1 = map_results[i];
-                result2 = map_results[j];
+        }
+
+        // merges runs of both groups to one packed run (values of equal keys are combined if there is combiner)
+        void merge_run_groups(TaskGroup& tasks, std::size_t partition_idx, RunGroup first, RunGroup second) {
+            RunGroup group{std::min(first.first_task, second.first_task),
+                           std::max(first.last_task, second.last_task), {}, true};
+            auto runs = std::move(first.runs);
+            for (auto& run: second.runs)
+                runs.push_back(std::move(run));
+            MergedRuns<map_result_t> merged(std::move(runs));
+            std::vector<char> bytes;
+            PackedWriter<map_result_t> writer;
+            map_result_t elem;
+            if constexpr (std::is_same_v<CombineCls, NoCombiner>) {
+                while (merged.next(elem))
+                    writer.write(bytes, elem);
             } else {
-                int middle = (i + j) / 2;
-                // result1 = merge_map_results(i, middle);
-                std::future<std::vector<map_result_t>> result1_future = std::async(
-                        std::launch::async,
-                        [this, i, middle] {
-                            return this->merge_map_results(i, middle);
-                        });
-                result2 = merge_map_results(middle + 1, j);
-                result1 = result1_future.get();
+                CombineCls combiner{};
+                map_result_t next;
+                bool has_elem = merged.next(elem);
+                while (has_elem) {
+                    bool has_next;
+                    while ((has_next = merged.next(next)) && next.first == elem.first)
+                        combiner(elem.first, elem.second, std::move(next.second));
+                    writer.write(bytes, elem);
+                    has_elem = has_next;
+                    if (has_next)
+                        elem = std::move(next);
+                }
             }
+            bytes.shrink_to_fit();
+            group.runs.push_back(std::make_unique<PackedRun<map_result_t>>(std::move(bytes)));
 
-            std::vector<map_result_t> result{};
-            result.reserve(result1.size() + result2.size());
-
-            int i1 = 0;
-            int i2 = 0;
-            while (i1 < result1.size() || i2 < result2.size()) {
-                if (i1 >= result1.size())
-                    result.emplace_back(result2[i2++]);
-                else if (i2 >= result2.size())
-                    result.emplace_back(result1[i1++]);
-                else if (result1[i1].first <= result2[i2].first)
-                    result.emplace_back(result1[i1++]);
-                else
-                    result.emplace_back(result2[i2++]);
+            auto& partition = pipeline->partitions[partition_idx];
+            std::lock_guard<std::mutex> lock(partition.mutex);
+            add_run_group(partition, std::move(group));
+            partition.merges_running--;
+            pipeline->merges_running--;
+            if (pipeline->map_tasks_running > 0)
+                start_merges(tasks, partition_idx);
+            else
+                start_reduce_if_ready(tasks, partition_idx);
+        }
+
+        // merges before all map tasks are started delay them, merges after the last one delay reduce,
+        // and merges don't take more workers than map tasks leave idle (merging is additional work)
+        bool has_idle_worker() const {
+            auto mapping = pipeline->map_tasks_mapping.load();
+            return pipeline->map_tasks_waiting == 0 && mapping > 0 &&
+                   mapping + pipeline->merges_running < static_cast<std::size_t>(thread_pool->size());
+        }
+
+        // called under lock of partition: by the last map task and by merges finished after it
+        void start_reduce_if_ready(TaskGroup& tasks, std::size_t partition_idx) {
+            auto& partition = pipeline->partitions[partition_idx];
+            if (partition.reduce_started || partition.merges_running > 0 || pipeline->map_tasks_running > 0)
+                return;
+            partition.reduce_started = true;
+            std::vector<run_ptr_t> runs;
+            for (auto& group: partition.groups)
+                for (auto& run: group.runs)
+                    runs.push_back(std::move(run));
+            partition.groups.clear();
+            partitions[partition_idx] = std::make_unique<MergedRuns<map_result_t>>(std::move(runs));
+            tasks.run([this, partition_idx] { this->run_reduce_task(partition_idx); });
+        }
+
+        // puts map result to bucket of its partition,
+        // spills buckets to disk when mapper exceeds memory budget
+        void emit(int container_idx, map_key_t&& key, map_value_t&& value) {
+            auto& task = *map_tasks[container_idx];
+            auto& bucket = task.buckets[PartitionCls{}(key, task.buckets.size())];
+            bucket.emplace_back(std::move(key), std::move(value));
+            task.stats.pairs_emitted++;
+            task.buffered_pairs++;
+            if (memory_budget > 0) {
+                task.buffered_bytes += approximate_size(bucket.back());
+                if (task.buffered_bytes > memory_budget)
+                    spill_buckets(container_idx);
+            } else if (task.buffered_pairs >= pack_size) {
+                pack_buckets(container_idx); // with memory budget big buckets are spilled instead
             }
+        }
 
-            return result;
-        };
+        // calls map function for record, its results go directly to buckets of map task
+        void map_record(MapCls& map_func, int container_idx, std::string_view record) {
+            auto emit_pair = [this, container_idx](map_key_t key, map_value_t value) {
+                this->emit(container_idx, std::move(key), std::move(value));
+            };
+            MapTraits<MapCls>::map(map_func, filename, record, emit_pair);
+        }
 
-        // sorting intermediate data
-        void run_shuffle() {
-            map_results_flat = merge_map_results(0, map_results.size() - 1);
-        };
+        // sorts buckets of mapper and writes each bucket as a run file
+        void spill_buckets(int container_idx) {
+            sort_buckets(container_idx);
+            auto& task = *map_tasks[container_idx];
+            auto& buckets = task.buckets;
+            for (size_t i = 0; i < buckets.size(); i++) {
+                if (buckets[i].empty())
+                    continue;
+                auto run_filename = spill_directory->file(
+                        "map_" + std::to_string(container_idx) + "_part_" + std::to_string(i) + "_" +
+                        std::to_string(task.spilled_runs[i].size()) + ".run");
+                RunWriter<map_result_t> writer(run_filename);
+                for (const auto& elem: buckets[i])
+                    writer.write(elem);
+                writer.close();
+                task.spilled_runs[i].push_back(run_filename);
+                task.stats.spilled_runs++;
+                std::vector<map_result_t>().swap(buckets[i]);
+            }
+            task.buffered_bytes = 0;
+            task.buffered_pairs = 0;
+        }
 
+        // sorts all buckets of mapper by key, so partitions can be merged
+        // (string keys are sorted with radix sort, values of equal keys stay in order of emitting
+        // unless reducer is order insensitive)
+        void sort_buckets(int container_idx) {
+            auto& task = *map_tasks[container_idx];
+            for (auto& bucket: task.buckets) {
+                sort_by_key<!ReduceTraits<ReduceCls>::order_insensitive>(bucket);
+                if constexpr (!std::is_same_v<CombineCls, NoCombiner>)
+                    combine_sorted<CombineCls>(bucket);
+                task.stats.pairs_shuffled += bucket.size();
+            }
+        }
+
+        // sorts buckets of mapper and packs each of them as a new run: packed pairs are several times smaller
+        // and are read sequentially by merge
+        void pack_buckets(int container_idx) {
+            sort_buckets(container_idx);
+            auto& task = *map_tasks[container_idx];
+            auto& buckets = task.buckets;
+            for (size_t i = 0; i < buckets.size(); i++) {
+                if (buckets[i].empty())
+                    continue;
+                task.packed_runs[i].push_back(pack_pairs(buckets[i]));
+                std::vector<map_result_t>().swap(buckets[i]);
+            }
+            task.buffered_pairs = 0;
+        }
 
         // reads data from file and calls map function
         // writes to separated container: no need to use mutex
-        void run_single_mapper(int i_start, int i_end, int container_idx) {
-            std::ifstream file(filename);
+        void run_single_mapper(std::ifstream& file, std::streamoff i_start, std::streamoff i_end, int container_idx) {
+            file.clear();
             file.seekg(i_start);
             std::string current_email;
             MapCls map_func{};
+            auto& task_stats = map_tasks[container_idx]->stats;
             while (file.tellg() < i_end && (file >> current_email)) {
                 if (file.tellg() <= i_end) { // additional check boundaries
-                    auto map_result = map_func(filename, current_email);
-                    map_results[container_idx].reserve(map_results[container_idx].size() + map_result.size());
-                    std::move(map_result.begin(), map_result.end(), std::back_inserter(map_results[container_idx]));
+                    task_stats.records++;
+                    task_stats.bytes += current_email.size();
+                    map_record(map_func, container_idx, map_tasks[container_idx]->records.store(current_email));
                 }
             }
-            file.close();
-            std::stable_sort(map_results[container_idx].begin(), map_results[container_idx].end());
+            pack_buckets(container_idx);
+        }
+
+        // calls map function for records from data[start, end), records point into mapped file (no copy)
+        // writes to separated container: no need to use mutex
+        void run_single_mapper_mmap(std::string_view data, std::uint64_t start, std::uint64_t end,
+                                    int container_idx) {
+            MapCls map_func{};
+            auto& task_stats = map_tasks[container_idx]->stats;
+            for_each_record(data, start, end, [&](std::string_view email) {
+                task_stats.records++;
+                task_stats.bytes += email.size();
+                map_record(map_func, container_idx, email);
+            });
+            pack_buckets(container_idx);
         }
     };
 }
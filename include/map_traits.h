@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <type_traits>
+
+namespace mapreduce {
+    // compile-time description of map and reduce functions, the runner chooses its code paths from it
+    //
+    // mappers can be written in two ways:
+    // - sink: declares kv_t (pair of key and value) and calls emit(key, value) for each result,
+    //   template<typename Emit> void operator()(const std::string& key, std::string_view record, Emit& emit)
+    //   nothing is allocated per record, pairs go directly to buckets of map task
+    // - vector: std::vector<pair> operator()(const std::string& key, std::string_view record)
+
+    namespace detail {
+        // emit callback used to check signature of sink mappers
+        template<typename Pair>
+        struct EmitProbe {
+            void operator()(typename Pair::first_type, typename Pair::second_type) {}
+        };
+
+        template<typename MapCls, typename = void>
+        struct is_sink_mapper : std::false_type {
+        };
+
+        template<typename MapCls>
+        struct is_sink_mapper<MapCls, std::void_t<typename MapCls::kv_t>> :
+                std::is_invocable<MapCls&, const std::string&, std::string_view,
+                        EmitProbe<typename MapCls::kv_t>&> {
+        };
+
+        template<typename MapCls, bool sink = is_sink_mapper<MapCls>::value>
+        struct map_pair {
+            using type = typename MapCls::kv_t;
+        };
+
+        template<typename MapCls>
+        struct map_pair<MapCls, false> {
+            using type = typename std::invoke_result_t<MapCls&, const std::string&, std::string_view>::value_type;
+        };
+
+        template<typename ReduceCls, typename = void>
+        struct is_order_insensitive : std::false_type {
+        };
+
+        template<typename ReduceCls>
+        struct is_order_insensitive<ReduceCls, std::void_t<decltype(ReduceCls::order_insensitive)>> :
+                std::bool_constant<ReduceCls::order_insensitive> {
+        };
+    }
+
+    template<typename MapCls>
+    struct MapTraits {
+        static constexpr bool sink = detail::is_sink_mapper<MapCls>::value;
+        using pair_t = typename detail::map_pair<MapCls>::type;
+        using key_t = typename pair_t::first_type;
+        using value_t = typename pair_t::second_type;
+
+        // calls map function for record, emit(key, value) gets its results
+        template<typename Emit>
+        static void map(MapCls& map_func, const std::string& key, std::string_view record, Emit& emit) {
+            if constexpr (sink) {
+                map_func(key, record, emit);
+            } else {
+                for (auto& elem: map_func(key, record))
+                    emit(std::move(elem.first), std::move(elem.second));
+            }
+        }
+    };
+
+    // reducer declares static constexpr bool order_insensitive = true when its result doesn't depend
+    // on order of values of a key: then values of equal keys don't need to keep order of emitting
+    template<typename ReduceCls>
+    struct ReduceTraits {
+        static constexpr bool order_insensitive = detail::is_order_insensitive<ReduceCls>::value;
+    };
+}
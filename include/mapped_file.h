@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <istream>
+#include <vector>
+#include <system_error>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mapreduce {
+    // read-only memory mapping of the whole file
+    // data stays valid while the object is alive, so records can be passed around as string_view
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& filename) {
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "can't open " + filename);
+
+            struct stat file_stat{};
+            if (::fstat(fd, &file_stat) != 0) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), "can't stat " + filename);
+            }
+
+            size = static_cast<std::size_t>(file_stat.st_size);
+            if (size > 0) { // mmap of zero length is not allowed, empty file => empty data
+                void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (addr == MAP_FAILED) {
+                    int err = errno;
+                    ::close(fd);
+                    throw std::system_error(err, std::generic_category(), "can't mmap " + filename);
+                }
+                ::madvise(addr, size, MADV_SEQUENTIAL);
+                data = static_cast<const char *>(addr);
+            }
+            ::close(fd); // mapping keeps its own reference to the file
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+            if (data != nullptr)
+                ::munmap(const_cast<char *>(data), size);
+        }
+
+        std::string_view view() const {
+            return {data, size};
+        }
+
+    private:
+        const char *data = nullptr;
+        std::size_t size = 0;
+    };
+
+    // moves position to the beginning of the next line (if it is not already at the beginning of a line)
+    // used to split data into byte ranges without scanning the whole file first
+    inline std::uint64_t align_to_line_start(std::string_view data, std::uint64_t position) {
+        if (position == 0 || position >= data.size())
+            return std::min<std::uint64_t>(position, data.size());
+        if (data[position - 1] == '\n')
+            return position;
+        auto next_newline = data.find('\n', position);
+        return next_newline == std::string_view::npos ? data.size() : next_newline + 1;
+    }
+
+    // the same for a file of size bytes read with stream: blocks from position - 1 are scanned with memchr
+    // (vectorized in libc) until '\n', so only a few bytes around position are read
+    inline std::uint64_t align_to_line_start(std::istream& in, std::uint64_t position, std::uint64_t size) {
+        if (position == 0 || position >= size)
+            return std::min(position, size);
+        std::vector<char> block(1 << 16);
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(position - 1));
+        auto offset = position - 1;
+        while (offset < size && in.read(block.data(), static_cast<std::streamsize>(block.size())).gcount() > 0) {
+            auto count = static_cast<std::size_t>(in.gcount());
+            if (auto newline = static_cast<const char *>(std::memchr(block.data(), '\n', count)))
+                return std::min(offset + static_cast<std::uint64_t>(newline - block.data()) + 1, size);
+            offset += count;
+        }
+        return size;
+    }
+
+    // calls func for each whitespace-separated record in data[start, end)
+    // (same records as reading with operator>>)
+    template<typename Func>
+    void for_each_record(std::string_view data, std::uint64_t start, std::uint64_t end, Func&& func) {
+        auto is_space = [](char c) {
+            return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+        };
+        auto i = start;
+        while (i < end) {
+            while (i < end && is_space(data[i]))
+                i++;
+            auto record_start = i;
+            while (i < end && !is_space(data[i]))
+                i++;
+            if (i > record_start)
+                func(data.substr(record_start, i - record_start));
+        }
+    }
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef YAMR_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace mapreduce {
+    // destination of reducer output: reducers append text, sink collects it into big blocks,
+    // so there is one system call per block instead of one formatted stream write per key
+    class OutputSink {
+    public:
+        explicit OutputSink(std::size_t buffer_size = 1 << 20) : buffer(buffer_size) {}
+
+        OutputSink(const OutputSink&) = delete;
+        OutputSink& operator=(const OutputSink&) = delete;
+
+        virtual ~OutputSink() = default;
+
+        void write(std::string_view text) {
+            if (text.size() > buffer.size() - used) {
+                // big text goes to the destination together with buffered data, without copying
+                write_blocks({buffer.data(), used}, text.size() >= buffer.size() ? text : std::string_view());
+                used = 0;
+                if (text.size() >= buffer.size())
+                    return;
+            }
+            std::memcpy(buffer.data() + used, text.data(), text.size());
+            used += text.size();
+        }
+
+        void write_line(std::string_view line) {
+            write(line);
+            write("\n");
+        }
+
+        // writes buffered data
+        void flush() {
+            if (used > 0)
+                write_blocks({buffer.data(), used}, {});
+            used = 0;
+        }
+
+        // writes buffered data and closes destination, throws if any of it fails: output is complete only
+        // after close(), destructors of sinks only release destination (e.g. after an error) and don't write
+        virtual void close() {
+            flush();
+        }
+
+    protected:
+        // writes buffered data and then extra text
+        virtual void write_blocks(std::string_view buffered, std::string_view extra) = 0;
+
+    private:
+        std::vector<char> buffer;
+        std::size_t used = 0;
+    };
+
+    // output is not needed: nothing is written, no files are created
+    class NullSink : public OutputSink {
+    public:
+        NullSink() : OutputSink(1 << 12) {}
+
+    protected:
+        void write_blocks(std::string_view, std::string_view) override {}
+    };
+
+    // text file written in big blocks
+    class FileSink : public OutputSink {
+    public:
+        explicit FileSink(const std::string& filename_) : filename(filename_) {
+            fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "can't create " + filename);
+        }
+
+        ~FileSink() override {
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        void close() override {
+            flush();
+            auto closed = ::close(fd);
+            fd = -1;
+            if (closed != 0) // e.g. delayed write error of network file system
+                throw std::system_error(errno, std::generic_category(), "can't write " + filename);
+        }
+
+    protected:
+        void write_blocks(std::string_view buffered, std::string_view extra) override {
+            iovec blocks[2] = {{const_cast<char *>(buffered.data()), buffered.size()},
+                               {const_cast<char *>(extra.data()), extra.size()}};
+            int first = 0;
+            while (first < 2) {
+                auto written = ::writev(fd, blocks + first, 2 - first);
+                if (written < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw std::system_error(errno, std::generic_category(), "can't write " + filename);
+                }
+                // partial write: skip written bytes
+                auto left = static_cast<std::size_t>(written);
+                while (first < 2 && left >= blocks[first].iov_len)
+                    left -= blocks[first++].iov_len;
+                if (first < 2) {
+                    blocks[first].iov_base = static_cast<char *>(blocks[first].iov_base) + left;
+                    blocks[first].iov_len -= left;
+                }
+            }
+        }
+
+    private:
+        std::string filename;
+        int fd = -1;
+    };
+
+#ifdef YAMR_HAVE_ZLIB
+    // gzip compressed text file
+    class GzipSink : public OutputSink {
+    public:
+        explicit GzipSink(const std::string& filename_) : filename(filename_) {
+            file = ::gzopen(filename.c_str(), "wb1");
+            if (file == nullptr)
+                throw std::runtime_error("can't create " + filename);
+        }
+
+        ~GzipSink() override {
+            if (file != nullptr)
+                ::gzclose(file);
+        }
+
+        // gzclose writes the rest of compressed data
+        void close() override {
+            flush();
+            auto closed = ::gzclose(file);
+            file = nullptr;
+            if (closed != Z_OK)
+                throw std::runtime_error("can't write " + filename);
+        }
+
+    protected:
+        void write_blocks(std::string_view buffered, std::string_view extra) override {
+            for (auto block: {buffered, extra})
+                if (!block.empty() && ::gzwrite(file, block.data(), static_cast<unsigned>(block.size())) == 0)
+                    throw std::runtime_error("can't write " + filename);
+        }
+
+    private:
+        std::string filename;
+        gzFile file = nullptr;
+    };
+#endif
+
+    // output of reduce tasks:
+    // - text: "<name>.txt" for each task
+    // - gzip: "<name>.txt.gz" (only when built with zlib)
+    // - none: output is discarded
+    enum class OutputFormat {
+        text,
+        gzip,
+        none
+    };
+
+    inline bool output_format_supported(OutputFormat format) {
+#ifdef YAMR_HAVE_ZLIB
+        return true;
+#else
+        return format != OutputFormat::gzip;
+#endif
+    }
+
+    // extension of output files, empty for none
+    inline std::string output_extension(OutputFormat format) {
+        switch (format) {
+            case OutputFormat::text:
+                return ".txt";
+            case OutputFormat::gzip:
+                return ".txt.gz";
+            default:
+                return "";
+        }
+    }
+
+    // path_without_extension: e.g. "out/reduce_0"
+    inline std::unique_ptr<OutputSink> make_output_sink(OutputFormat format, const std::string& path_without_extension) {
+        switch (format) {
+            case OutputFormat::none:
+                return std::make_unique<NullSink>();
+#ifdef YAMR_HAVE_ZLIB
+            case OutputFormat::gzip:
+                return std::make_unique<GzipSink>(path_without_extension + output_extension(format));
+#endif
+            case OutputFormat::text:
+                return std::make_unique<FileSink>(path_without_extension + output_extension(format));
+            default:
+                throw std::invalid_argument("output format is not supported by this build");
+        }
+    }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+
+namespace mapreduce {
+    // compact binary format of sorted intermediate pairs, used for in-memory buckets and run files:
+    // pairs are encoded one after another into contiguous bytes and decoded sequentially
+    // - std::string: front coding, length of common prefix with the previous string of the same field + the rest
+    // - std::string_view: bytes are in runner-owned memory (mapped input or arena), so only varint delta
+    //   of address and size are stored; the value is encoded relative to the key of its pair,
+    //   so a value which the key is a prefix of (as in prefix mappers) takes 2 bytes
+    // - integers: zigzag varint, other arithmetic types: raw bytes, empty types: nothing
+
+    constexpr std::size_t max_varint_size = 10;
+
+    inline void write_varint(char *& out, std::uint64_t value) {
+        while (value >= 0x80) {
+            *out++ = static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        *out++ = static_cast<char>(value);
+    }
+
+    inline std::uint64_t read_varint(const char *& in) {
+        std::uint64_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            auto byte = static_cast<unsigned char>(*in++);
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if (byte < 0x80)
+                return value;
+        }
+    }
+
+    inline std::uint64_t zigzag(std::int64_t value) {
+        return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+    }
+
+    inline std::int64_t unzigzag(std::uint64_t value) {
+        return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+    }
+
+    // encodes values of one field of pairs, keeps previous value to encode the next one relative to it
+    // encode() writes at most max_size(value) bytes
+    template<typename T, typename Enable = void>
+    struct PackedCodec;
+
+    template<>
+    struct PackedCodec<std::string> {
+        std::string previous;
+
+        static std::size_t max_size(const std::string& value) {
+            return 2 * max_varint_size + value.size();
+        }
+
+        void encode(char *& out, const std::string& value) {
+            std::size_t common = 0;
+            auto max_common = std::min(previous.size(), value.size());
+            while (common < max_common && previous[common] == value[common])
+                common++;
+            write_varint(out, common);
+            write_varint(out, value.size() - common);
+            std::memcpy(out, value.data() + common, value.size() - common);
+            out += value.size() - common;
+            previous = value;
+        }
+
+        void decode(const char *& in, std::string& value) {
+            auto common = read_varint(in);
+            auto rest = read_varint(in);
+            previous.resize(common);
+            previous.append(in, rest);
+            in += rest;
+            value = previous;
+        }
+    };
+
+    template<>
+    struct PackedCodec<std::string_view> {
+        std::uintptr_t previous = 0; // address of previous view
+
+        static std::size_t max_size(std::string_view) {
+            return 2 * max_varint_size;
+        }
+
+        void encode(char *& out, std::string_view value) {
+            auto address = reinterpret_cast<std::uintptr_t>(value.data());
+            write_varint(out, zigzag(static_cast<std::int64_t>(address - previous)));
+            write_varint(out, value.size());
+            previous = address;
+        }
+
+        void decode(const char *& in, std::string_view& value) {
+            auto address = previous + static_cast<std::uintptr_t>(unzigzag(read_varint(in)));
+            value = std::string_view(reinterpret_cast<const char *>(address), read_varint(in));
+            previous = address;
+        }
+    };
+
+    template<typename T>
+    struct PackedCodec<T, std::enable_if_t<std::is_integral_v<T>>> {
+        static std::size_t max_size(T) {
+            return max_varint_size;
+        }
+
+        void encode(char *& out, T value) {
+            if constexpr (std::is_signed_v<T>)
+                write_varint(out, zigzag(static_cast<std::int64_t>(value)));
+            else
+                write_varint(out, static_cast<std::uint64_t>(value));
+        }
+
+        void decode(const char *& in, T& value) {
+            if constexpr (std::is_signed_v<T>)
+                value = static_cast<T>(unzigzag(read_varint(in)));
+            else
+                value = static_cast<T>(read_varint(in));
+        }
+    };
+
+    template<typename T>
+    struct PackedCodec<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+        static std::size_t max_size(T) {
+            return sizeof(T);
+        }
+
+        void encode(char *& out, T value) {
+            std::memcpy(out, &value, sizeof(value));
+            out += sizeof(value);
+        }
+
+        void decode(const char *& in, T& value) {
+            std::memcpy(&value, in, sizeof(value));
+            in += sizeof(value);
+        }
+    };
+
+    // values without state (e.g. of keys which are only counted) take no bytes
+    template<typename T>
+    struct PackedCodec<T, std::enable_if_t<std::is_empty_v<T>>> {
+        static std::size_t max_size(const T&) {
+            return 0;
+        }
+
+        void encode(char *&, const T&) {}
+
+        void decode(const char *&, T& value) {
+            value = T{};
+        }
+    };
+
+    template<typename Pair>
+    constexpr bool value_relative_to_key = std::is_same_v<typename Pair::first_type, std::string_view> &&
+                                           std::is_same_v<typename Pair::second_type, std::string_view>;
+
+    // appends encoded pairs to bytes
+    template<typename Pair>
+    class PackedWriter {
+    public:
+        void write(std::vector<char>& out, const Pair& elem) {
+            auto size = out.size();
+            out.resize(size + key_codec.max_size(elem.first) + value_codec.max_size(elem.second));
+            auto position = out.data() + size;
+            key_codec.encode(position, elem.first);
+            if constexpr (value_relative_to_key<Pair>)
+                value_codec.previous = reinterpret_cast<std::uintptr_t>(elem.first.data());
+            value_codec.encode(position, elem.second);
+            out.resize(static_cast<std::size_t>(position - out.data()));
+        }
+
+    private:
+        PackedCodec<typename Pair::first_type> key_codec;
+        PackedCodec<typename Pair::second_type> value_codec;
+    };
+
+    // decodes pairs written by PackedWriter from bytes
+    template<typename Pair>
+    class PackedReader {
+    public:
+        explicit PackedReader(std::string_view data_ = {}) :
+                position(data_.data()), end(data_.data() + data_.size()) {}
+
+        bool read(Pair& elem) {
+            if (position == end)
+                return false;
+            key_codec.decode(position, elem.first);
+            if constexpr (value_relative_to_key<Pair>)
+                value_codec.previous = reinterpret_cast<std::uintptr_t>(elem.first.data());
+            value_codec.decode(position, elem.second);
+            return true;
+        }
+
+    private:
+        const char *position;
+        const char *end;
+        PackedCodec<typename Pair::first_type> key_codec;
+        PackedCodec<typename Pair::second_type> value_codec;
+    };
+
+    // sorted pairs packed to contiguous bytes
+    template<typename Pair>
+    std::vector<char> pack_pairs(const std::vector<Pair>& pairs) {
+        std::vector<char> bytes;
+        PackedWriter<Pair> writer;
+        for (const auto& elem: pairs)
+            writer.write(bytes, elem);
+        bytes.shrink_to_fit();
+        return bytes;
+    }
+}
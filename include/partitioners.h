@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace mapreduce {
+    // partitioner decides which reducer gets the key:
+    // std::size_t operator()(const key_t& key, std::size_t num_partitions) const -> [0, num_partitions)
+    // all pairs with equal keys must go to the same partition
+
+    // default partitioner: spreads keys uniformly over reducers by hash
+    struct HashPartitioner {
+        template<typename Key>
+        std::size_t operator()(const Key& key, std::size_t num_partitions) const {
+            return std::hash<Key>{}(key) % num_partitions;
+        }
+    };
+
+    // range partitioner by first byte of key: partitions are ordered,
+    // so concatenation of reducer outputs is sorted by key (like in original global merge)
+    struct FirstByteRangePartitioner {
+        std::size_t operator()(std::string_view key, std::size_t num_partitions) const {
+            auto first_byte = key.empty() ? 0u : static_cast<unsigned char>(key[0]);
+            return first_byte * num_partitions / 256;
+        }
+    };
+}
@@ -0,0 +1,401 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "string_sort.h"
+#include "runner_stats.h"
+#include "random.h"
+#include "lcp.h"
+
+namespace prefix_approximate {
+    // approximate engine for the same task: fast estimate for big inputs (e.g. to size prefix routing tables)
+    // - sample: each map task scans its part of the file and keeps uniform reservoir sample of its emails
+    //   (parts of the file are strata of equal size); answer for the sample is an exact lower bound,
+    //   because emails added to a set can only make common prefixes of neighbours longer
+    // - check: answer > L only if two distinct emails have equal prefixes of length L, so the second scan
+    //   inserts prefixes of candidate lengths L (from the lower bound up) to a bloom filter,
+    //   prefixes which were seen before are suspects (bloom filter has no false negatives)
+    // - verify: the third scan compares emails with suspected prefixes exactly (there are few of them unless
+    //   L is below the answer), the smallest L without distinct emails with equal prefixes is the upper bound
+    // - duplicated emails have equal prefixes too: a prefix seen before is not a suspect if its email was seen
+    //   before (another bloom filter); a false positive of that filter can hide a pair of distinct emails,
+    //   so the upper bound holds with probability >= 1 - (false positive rate of email filter)
+    // all scans only hash emails, the whole input is never sorted
+
+    // answer is in [lower, upper] with probability >= confidence (lower bound is exact)
+    struct PrefixBounds {
+        int lower = 0;
+        int upper = 0;
+        double confidence = 0;
+    };
+
+    // bloom filter with all bits of a key in one 64-bit word: one cache miss per key, and insert is a single
+    // atomic fetch_or, so of two concurrent inserts of equal keys one always sees the key as present
+    class BlockedBloomFilter {
+    public:
+        static constexpr int bits_per_hash = 8;
+
+        BlockedBloomFilter(std::uint64_t num_keys, int bits_per_key) :
+                num_words(std::max<std::uint64_t>(num_keys * static_cast<std::uint64_t>(bits_per_key) / 64, 1)),
+                words(new std::atomic<std::uint64_t>[num_words]()) {}
+
+        // adds key (hash), returns true if it was (probably) added before
+        bool insert(std::uint64_t hash) {
+            auto mask = key_mask(hash);
+            return (word(hash).fetch_or(mask, std::memory_order_relaxed) & mask) == mask;
+        }
+
+        bool contains(std::uint64_t hash) const {
+            auto mask = key_mask(hash);
+            return (word(hash).load(std::memory_order_relaxed) & mask) == mask;
+        }
+
+        // loads word of key to cache in background: filters are much bigger than cache, so inserts
+        // are faster when words of a few next keys are requested in advance
+        void prefetch(std::uint64_t hash) const {
+            __builtin_prefetch(&word(hash), 1);
+        }
+
+        // probability that a new key is reported as present, estimated from the share of set bits
+        double false_positive_rate() const {
+            std::uint64_t set_bits = 0;
+            for (std::uint64_t i = 0; i < num_words; i++)
+                set_bits += static_cast<std::uint64_t>(__builtin_popcountll(words[i].load(std::memory_order_relaxed)));
+            auto fill = static_cast<double>(set_bits) / static_cast<double>(num_words * 64);
+            double rate = 1;
+            for (int i = 0; i < bits_per_hash; i++)
+                rate *= fill;
+            return rate;
+        }
+
+    private:
+        std::uint64_t num_words;
+        std::unique_ptr<std::atomic<std::uint64_t>[]> words;
+
+        std::atomic<std::uint64_t>& word(std::uint64_t hash) const {
+            return words[static_cast<std::uint64_t>((static_cast<unsigned __int128>(hash) * num_words) >> 64)];
+        }
+
+        static std::uint64_t key_mask(std::uint64_t hash) {
+            std::uint64_t mask = 0;
+            auto bits = mapreduce::mix64(hash);
+            for (int i = 0; i < bits_per_hash; i++, bits >>= 6)
+                mask |= std::uint64_t{1} << (bits & 63);
+            return mask;
+        }
+    };
+
+    class ApproximatePrefixEngine {
+    public:
+        ApproximatePrefixEngine(std::string filename_, int num_threads_map_, int num_threads_reduce_) :
+                filename(std::move(filename_)),
+                num_threads_map(num_threads_map_),
+                num_threads_reduce(num_threads_reduce_) {}
+
+        // number of sampled emails (split between map tasks), inputs not bigger than that give exact answer
+        void set_sample_size(std::size_t sample_size_) {
+            sample_size = std::max<std::size_t>(sample_size_, 1);
+        }
+
+        // memory of each bloom filter per email (per email and candidate length for prefixes):
+        // more bits - fewer false positives, so tighter upper bound with higher confidence
+        void set_bits_per_email(int bits_per_email_) {
+            bits_per_email = std::max(bits_per_email_, 1);
+        }
+
+        // workers are pinned to cpus, filling one NUMA node before the next one (see ThreadPool)
+        void set_pin_threads(bool pin_threads_) {
+            pin_threads = pin_threads_;
+        }
+
+        // returns vector with upper bound (or empty vector for file without emails), like MapReduceRunner
+        std::vector<int> process() {
+            run_stats = mapreduce::RunnerStats();
+            prefix_bounds = PrefixBounds();
+            mapreduce::ThreadPool thread_pool(std::max(num_threads_map, num_threads_reduce), pin_threads);
+            run_stats.unpinned_workers = thread_pool.pinning_failures();
+            std::unique_ptr<mapreduce::MappedFile> mapped_file;
+            run_phase("split", [&] { mapped_file = std::make_unique<mapreduce::MappedFile>(filename); });
+            auto data = mapped_file->view();
+
+            std::vector<std::string_view> sample;
+            std::uint64_t num_emails = 0;
+            std::size_t max_length = 0;
+            run_phase("sample", [&] {
+                sample = sample_emails(thread_pool, data, num_emails, max_length);
+                prefix_bounds.lower = sample_answer(sample);
+            });
+            std::vector<int> result;
+            if (num_emails == 0) {
+                run_stats.peak_rss_bytes = mapreduce::peak_rss_bytes();
+                return result;
+            }
+
+            check_candidates(thread_pool, data, num_emails, static_cast<int>(max_length));
+            result.push_back(prefix_bounds.upper);
+            run_stats.peak_rss_bytes = mapreduce::peak_rss_bytes();
+            return result;
+        }
+
+        // bounds found by the last process() call
+        const PrefixBounds& bounds() const {
+            return prefix_bounds;
+        }
+
+        // statistics of the last process() call: map tasks sample, reduce tasks check (keys are emails,
+        // pairs are inserted prefixes), then verify if there were suspects (no keys, pairs are suspected prefixes)
+        const mapreduce::RunnerStats& stats() const {
+            return run_stats;
+        }
+
+    private:
+        const std::string filename;
+        int num_threads_map;
+        int num_threads_reduce;
+        std::size_t sample_size = 1 << 16;
+        int bits_per_email = 16;
+        bool pin_threads = false;
+        PrefixBounds prefix_bounds;
+        mapreduce::RunnerStats run_stats;
+
+        template<typename Func>
+        void run_phase(const std::string& name, Func func) {
+            mapreduce::Stopwatch stopwatch;
+            func();
+            run_stats.phases.push_back({name, stopwatch.wall_seconds(), stopwatch.cpu_seconds()});
+        }
+
+        // calls func(task, start, end) for each part of data in thread pool, data is split into
+        // a part for each element of tasks_stats, where time of tasks is saved
+        template<typename TaskStats, typename Func>
+        static void for_each_part(mapreduce::ThreadPool& thread_pool, std::string_view data,
+                                  std::vector<TaskStats>& tasks_stats, Func func) {
+            auto num_tasks = tasks_stats.size();
+            thread_pool.parallel_for(num_tasks, [&](std::size_t i) {
+                mapreduce::Stopwatch stopwatch(CLOCK_THREAD_CPUTIME_ID);
+                auto start = mapreduce::align_to_line_start(data, data.size() * i / num_tasks);
+                auto end = mapreduce::align_to_line_start(data, data.size() * (i + 1) / num_tasks);
+                func(i, start, end);
+                auto& task_stats = tasks_stats[i];
+                task_stats.worker = thread_pool.worker_index();
+                task_stats.wall_seconds = stopwatch.wall_seconds();
+                task_stats.cpu_seconds = stopwatch.cpu_seconds();
+            });
+        }
+
+        // reservoir sample of each part (algorithm R, deterministic seed per part), counts emails
+        std::vector<std::string_view> sample_emails(mapreduce::ThreadPool& thread_pool, std::string_view data,
+                                                    std::uint64_t& num_emails, std::size_t& max_length) {
+            auto num_tasks = std::min<std::uint64_t>(num_threads_map, std::max<std::uint64_t>(data.size(), 1));
+            auto capacity = (sample_size + num_tasks - 1) / num_tasks;
+            std::vector<std::vector<std::string_view>> reservoirs(num_tasks);
+            std::vector<mapreduce::SplitMix64> random;
+            for (std::size_t i = 0; i < num_tasks; i++)
+                random.emplace_back(i + 1);
+            std::vector<std::size_t> max_lengths(num_tasks, 0);
+            run_stats.map_tasks.assign(num_tasks, mapreduce::MapTaskStats());
+            for_each_part(thread_pool, data, run_stats.map_tasks, [&](std::size_t i, auto start, auto end) {
+                auto& task_stats = run_stats.map_tasks[i];
+                auto& reservoir = reservoirs[i];
+                mapreduce::for_each_record(data, start, end, [&](std::string_view email) {
+                    if (reservoir.size() < capacity) {
+                        reservoir.push_back(email);
+                    } else {
+                        auto k = random[i].below(task_stats.records + 1);
+                        if (k < capacity)
+                            reservoir[k] = email;
+                    }
+                    task_stats.records++;
+                    task_stats.bytes += email.size();
+                    max_lengths[i] = std::max(max_lengths[i], email.size());
+                });
+            });
+
+            std::vector<std::string_view> sample;
+            for (std::size_t i = 0; i < num_tasks; i++) {
+                sample.insert(sample.end(), reservoirs[i].begin(), reservoirs[i].end());
+                num_emails += run_stats.map_tasks[i].records;
+                max_length = std::max(max_length, max_lengths[i]);
+            }
+            return sample;
+        }
+
+        // exact answer for sample, the same as prefix_optimized reducer
+        static int sample_answer(std::vector<std::string_view>& sample) {
+            mapreduce::string_sort(sample);
+            int result = 1;
+            for (std::size_t i = 1; i < sample.size(); i++)
+                if (sample[i - 1] != sample[i])
+                    result = std::max(result, static_cast<int>(lcp::common_prefix_length(sample[i - 1], sample[i])) + 1);
+            return result;
+        }
+
+        // lengths checked by the second scan: near the lower bound (it is usually exact for big enough sample)
+        // and a few more, doubling the distance; answer is always <= max_length
+        static constexpr int candidate_steps[] = {0, 1, 2, 4, 8};
+
+        static std::vector<int> candidate_lengths(int lower, int max_length) {
+            std::vector<int> candidates;
+            for (int step: candidate_steps)
+                if (lower + step < max_length)
+                    candidates.push_back(lower + step);
+            return candidates;
+        }
+
+        static constexpr std::size_t prefetch_distance = 16;
+
+        // hashes of the whole email and of its prefixes of candidate lengths (fnv-1a, candidates are increasing)
+        struct HashedEmail {
+            std::uint64_t email_hash = 0;
+            std::uint64_t prefix_hashes[std::size(candidate_steps)] = {};
+            std::size_t num_prefixes = 0; // candidates which are not longer than email
+
+            HashedEmail() = default;
+
+            HashedEmail(std::string_view email, const std::vector<int>& candidates) {
+                std::uint64_t hash = 0xcbf29ce484222325ull;
+                for (std::size_t length = 0; length < email.size(); length++) {
+                    hash = (hash ^ static_cast<unsigned char>(email[length])) * 0x100000001b3ull;
+                    if (num_prefixes < candidates.size() &&
+                        length + 1 == static_cast<std::size_t>(candidates[num_prefixes]))
+                        prefix_hashes[num_prefixes++] = mapreduce::mix64(hash + length + 1);
+                }
+                email_hash = mapreduce::mix64(hash ^ 0x9e3779b97f4a7c15ull);
+            }
+        };
+
+        // finds the smallest candidate length where no two distinct emails have equal prefixes
+        void check_candidates(mapreduce::ThreadPool& thread_pool, std::string_view data, std::uint64_t num_emails,
+                              int max_length) {
+            auto candidates = candidate_lengths(prefix_bounds.lower, max_length);
+            prefix_bounds.upper = std::max(max_length, prefix_bounds.lower);
+            prefix_bounds.confidence = 1;
+            if (candidates.empty())
+                return;
+
+            // check: prefixes seen before with new emails are suspects (distinct emails or false positives),
+            // at most sample_size of them for each candidate
+            BlockedBloomFilter emails(num_emails, bits_per_email);
+            BlockedBloomFilter prefixes(num_emails * candidates.size(), bits_per_email);
+            auto num_tasks = std::min<std::uint64_t>(num_threads_reduce, std::max<std::uint64_t>(data.size(), 1));
+            auto max_suspects = (sample_size + num_tasks - 1) / num_tasks;
+            // suspects[task][candidate]: hashes of suspected prefixes, too_many[task][candidate]: limit is exceeded
+            std::vector<std::vector<std::vector<std::uint64_t>>> suspects(
+                    num_tasks, std::vector<std::vector<std::uint64_t>>(candidates.size()));
+            std::vector<std::vector<char>> too_many(num_tasks, std::vector<char>(candidates.size(), false));
+            run_stats.reduce_tasks.assign(num_tasks, mapreduce::ReduceTaskStats());
+            run_phase("check", [&] {
+                for_each_part(thread_pool, data, run_stats.reduce_tasks, [&](std::size_t i, auto start, auto end) {
+                    auto& task_stats = run_stats.reduce_tasks[i];
+                    auto insert = [&](const HashedEmail& hashed) {
+                        bool email_seen = emails.insert(hashed.email_hash);
+                        for (std::size_t k = 0; k < hashed.num_prefixes; k++) {
+                            if (prefixes.insert(hashed.prefix_hashes[k]) && !email_seen) {
+                                if (suspects[i][k].size() < max_suspects)
+                                    suspects[i][k].push_back(hashed.prefix_hashes[k]);
+                                else
+                                    too_many[i][k] = true;
+                            }
+                        }
+                        task_stats.keys++;
+                        task_stats.pairs += hashed.num_prefixes;
+                    };
+                    // email is inserted prefetch_distance emails after its words are prefetched
+                    HashedEmail pending[prefetch_distance];
+                    std::size_t num_hashed = 0;
+                    mapreduce::for_each_record(data, start, end, [&](std::string_view email) {
+                        auto& hashed = pending[num_hashed++ % prefetch_distance];
+                        if (num_hashed > prefetch_distance)
+                            insert(hashed);
+                        hashed = HashedEmail(email, candidates);
+                        emails.prefetch(hashed.email_hash);
+                        for (std::size_t k = 0; k < hashed.num_prefixes; k++)
+                            prefixes.prefetch(hashed.prefix_hashes[k]);
+                    });
+                    for (auto j = num_hashed - std::min(num_hashed, prefetch_distance); j < num_hashed; j++)
+                        insert(pending[j % prefetch_distance]);
+                });
+            });
+
+            // verify: emails with suspected prefixes are compared exactly
+            // (each candidate whose suspects weren't dropped, candidate of each prefix hash is kept)
+            std::unordered_map<std::uint64_t, std::size_t> suspected;
+            std::size_t num_suspected = 0;
+            std::vector<char> verified(candidates.size(), true);
+            for (std::size_t i = 0; i < num_tasks; i++)
+                for (std::size_t k = 0; k < candidates.size(); k++)
+                    verified[k] = verified[k] && !too_many[i][k];
+            for (std::size_t i = 0; i < num_tasks; i++)
+                for (std::size_t k = 0; k < candidates.size(); k++)
+                    if (verified[k])
+                        num_suspected += suspects[i][k].size();
+            BlockedBloomFilter suspected_filter(num_suspected, bits_per_email); // small, filters map lookups
+            for (std::size_t i = 0; i < num_tasks; i++)
+                for (std::size_t k = 0; k < candidates.size(); k++)
+                    if (verified[k])
+                        for (auto hash: suspects[i][k]) {
+                            suspected.emplace(hash, k);
+                            suspected_filter.insert(hash);
+                        }
+            suspects.clear();
+
+            // first email of each suspected prefix (by task), collision[candidate]: distinct emails are found
+            struct FirstEmail {
+                std::string_view email;
+                bool distinct = false;
+            };
+            std::vector<std::unordered_map<std::uint64_t, FirstEmail>> first_emails(num_tasks);
+            std::vector<char> collision(candidates.size(), false);
+            auto add_email = [&](std::unordered_map<std::uint64_t, FirstEmail>& found, std::uint64_t hash,
+                                 const FirstEmail& email) {
+                auto [position, inserted] = found.emplace(hash, email);
+                if (!inserted && (email.distinct || email.email != position->second.email))
+                    position->second.distinct = true;
+            };
+            if (!suspected.empty()) {
+                std::vector<mapreduce::ReduceTaskStats> verify_stats(num_tasks);
+                run_phase("verify", [&] {
+                    for_each_part(thread_pool, data, verify_stats, [&](std::size_t i, auto start, auto end) {
+                        auto& task_stats = verify_stats[i];
+                        mapreduce::for_each_record(data, start, end, [&](std::string_view email) {
+                            HashedEmail hashed(email, candidates);
+                            for (std::size_t k = 0; k < hashed.num_prefixes; k++) {
+                                auto hash = hashed.prefix_hashes[k];
+                                if (suspected_filter.contains(hash) && suspected.count(hash) > 0) {
+                                    add_email(first_emails[i], hash, {email});
+                                    task_stats.pairs++;
+                                }
+                            }
+                        });
+                    });
+                    // equal hashes of different prefixes are very unlikely, they are counted as collisions
+                    for (std::size_t i = 1; i < num_tasks; i++)
+                        for (const auto& [hash, email]: first_emails[i])
+                            add_email(first_emails[0], hash, email);
+                    for (const auto& [hash, email]: first_emails[0])
+                        if (email.distinct)
+                            collision[suspected[hash]] = true;
+                });
+                run_stats.reduce_tasks.insert(run_stats.reduce_tasks.end(), verify_stats.begin(), verify_stats.end());
+            }
+
+            // a real pair of distinct emails is missed only if email filter falsely reported a new email as seen
+            for (std::size_t k = 0; k < candidates.size(); k++) {
+                if (verified[k] && !collision[k]) {
+                    prefix_bounds.upper = candidates[k];
+                    prefix_bounds.confidence = 1 - emails.false_positive_rate();
+                    return;
+                }
+            }
+        }
+    };
+}
@@ -1,14 +1,18 @@
 #pragma once
 
-#include <fstream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <algorithm>
+#include "lcp.h"
+#include "string_sort.h"
+#include "output_sink.h"
 
 namespace prefix {
     // implements original algorithm from Assignment
     // Mapper:
     // - take email as value
-    // - return list of pairs <prefix, email> for all prefixes
+    // - emit pairs <prefix, email> for all prefixes
     // - NB: we can't return list of pairs <prefix, email>, because we will loose information about duplicated emails
     // but for duplicated emails result should be 1
     // Reducer:
@@ -16,39 +20,42 @@ namespace prefix {
     // if number of values > 1 => result should be size(prefix) + 1,
     // but if all values are equal, result is 1 (here we need original emails)
 
-    using mapper_key_t = std::string;
-    using mapper_value_t = std::string;
+    using mapper_key_t = std::string_view;
+    using mapper_value_t = std::string_view;
     using reducer_value_t = int;
 
     class PrefixMapper {
     public:
         using kv_t = std::pair<mapper_key_t, mapper_value_t>;
 
-        std::vector<kv_t> operator()(const std::string& key, const std::string& email) {
-            std::vector<kv_t> result;
-            if (!email.empty()) {
-                result.reserve(email.size());
-                for (size_t n_prefix_elements = 1; n_prefix_elements <= email.size(); n_prefix_elements++) {
-                    result.emplace_back(email.substr(0, n_prefix_elements), email);
-                }
-            }
-            return result;
+        // pairs are passed to emit (see map_traits.h), no vector is allocated for each email
+        template<typename Emit>
+        void operator()(const std::string& key, std::string_view email, Emit& emit) {
+            for (size_t n_prefix_elements = 1; n_prefix_elements <= email.size(); n_prefix_elements++)
+                emit(email.substr(0, n_prefix_elements), email);
         }
     };
 
     class PrefixReducer {
     public:
-        explicit PrefixReducer(const std::string& filename) : f(filename), result(1) {};
-
-        int operator()(const mapper_key_t& key, const std::vector<mapper_value_t>& values) {
-            f << key << "\n";
-            if (values.size() > 1) {
-                bool all_emails_equal = true;
-                for (int i = 1; i < static_cast<int>(values.size()); i++)
-                    if (values[i] != values[i - 1]) {
-                        all_emails_equal = false;
-                        break;
-                    }
+        static constexpr bool order_insensitive = true;
+
+        explicit PrefixReducer(mapreduce::OutputSink& out_) : out(out_), result(1) {};
+
+        // values are read in one pass, so reducer works with streaming values range as well as with vector
+        template<typename Values>
+        int operator()(const mapper_key_t& key, Values& values) {
+            out.write_line(key);
+            size_t num_values = 0;
+            bool all_emails_equal = true;
+            mapper_value_t first_email;
+            for (const auto& email: values) {
+                if (num_values++ == 0)
+                    first_email = email;
+                else if (all_emails_equal && email != first_email)
+                    all_emails_equal = false;
+            }
+            if (num_values > 1) {
                 int current_result = static_cast<int>(key.size()) + 1;
                 if (all_emails_equal)
                     current_result = 1; // 1 - mininum, empty strings not used
@@ -59,7 +66,7 @@ namespace prefix {
         }
 
     private:
-        std::ofstream f;
+        mapreduce::OutputSink& out;
         reducer_value_t result;
     };
 }
@@ -69,13 +76,15 @@ namespace prefix_no_duplicates {
     // implements original algorithm from Assignment when there are no duplicated emails
     // Mapper:
     // - take email as value
-    // - return list of pairs <prefix, 1> for all prefixes
+    // - emit pairs <prefix, 1> for all prefixes
     // - NB: when return list of pairs <prefix, 1>, there is no information about duplicated emails
+    // Combiner (optional):
+    // folds values of equal prefixes in mapper output to one count, saturated at 2
     // Reducer:
-    // takes key (prefix) and list of values (1)
-    // if number of values > 1 => result should be size(prefix) + 1
+    // takes key (prefix) and list of values (counts)
+    // if sum of values > 1 => result should be size(prefix) + 1
 
-    using mapper_key_t = std::string;
+    using mapper_key_t = std::string_view;
     using mapper_value_t = int;
     using reducer_value_t = int;
 
@@ -83,32 +92,41 @@ namespace prefix_no_duplicates {
     public:
         using kv_t = std::pair<mapper_key_t, mapper_value_t>;
 
-        std::vector<kv_t> operator()(const std::string& key, const std::string& email) {
-            std::vector<kv_t> result;
-            if (!email.empty()) {
-                result.reserve(email.size());
-                for (size_t n_prefix_elements = 1; n_prefix_elements <= email.size(); n_prefix_elements++) {
-                    result.emplace_back(email.substr(0, n_prefix_elements), 1);
-                }
-            }
-            return result;
+        template<typename Emit>
+        void operator()(const std::string& key, std::string_view email, Emit& emit) {
+            for (size_t n_prefix_elements = 1; n_prefix_elements <= email.size(); n_prefix_elements++)
+                emit(email.substr(0, n_prefix_elements), 1);
+        }
+    };
+
+    class PrefixCombiner {
+    public:
+        // reducer only needs to know if prefix occurs more than once
+        void operator()(const mapper_key_t& key, mapper_value_t& accumulated, mapper_value_t&& value) {
+            accumulated = std::min(accumulated + value, 2);
         }
     };
 
     class PrefixReducer {
     public:
-        explicit PrefixReducer(const std::string& filename) : f(filename), result(1) {};
+        static constexpr bool order_insensitive = true;
+
+        explicit PrefixReducer(mapreduce::OutputSink& out_) : out(out_), result(1) {};
 
-        int operator()(const mapper_key_t& key, const std::vector<mapper_value_t>& values) {
-            f << key << "\n";
-            if (values.size() > 1)
+        template<typename Values>
+        int operator()(const mapper_key_t& key, Values& values) {
+            out.write_line(key);
+            mapper_value_t count = 0;
+            for (auto value: values)
+                count += value;
+            if (count > 1)
                 result = std::max(result, static_cast<int>(key.size()) + 1);
 
             return result;
         }
 
     private:
-        std::ofstream f;
+        mapreduce::OutputSink& out;
         reducer_value_t result;
     };
 }
@@ -117,52 +135,49 @@ namespace prefix_optimized {
     // implements optimized algorithm
     // Mapper:
     // - take email as value
-    // - return list of pairs <first letter, email>
+    // - emit pair <first letter, email>
     // Reducer:
     // takes key (first letter) and list of values (emails)
     // sorts them and finds shortest prefix to identify all emails
 
-    using mapper_key_t = std::string;
-    using mapper_value_t = std::string;
+    using mapper_key_t = std::string_view;
+    using mapper_value_t = std::string_view;
     using reducer_value_t = int;
 
     class PrefixMapper {
     public:
         using kv_t = std::pair<mapper_key_t, mapper_value_t>;
 
-        std::vector<kv_t> operator()(const std::string& key, const std::string& email) {
-            std::vector<kv_t> result({std::make_pair(std::string{email[0]}, email)});
-            return result;
+        template<typename Emit>
+        void operator()(const std::string& key, std::string_view email, Emit& emit) {
+            emit(email.substr(0, 1), email);
         }
     };
 
     class PrefixReducer {
     public:
-        explicit PrefixReducer(const std::string& filename) : f(filename), result(1) {};
+        static constexpr bool order_insensitive = true;
+
+        explicit PrefixReducer(mapreduce::OutputSink& out_) : out(out_), result(1) {};
 
         int operator()(const mapper_key_t& key, std::vector<mapper_value_t> values) {
-            f << key << "\n";
+            out.write_line(key);
             if (values.size() > 1) {
-                std::sort(values.begin(), values.end());
-                reducer_value_t current_result;
-                for (int i = 1; i < static_cast<int>(values.size()); i++) {
+                mapreduce::string_sort(values);
+                for (size_t i = 1; i < values.size(); i++) {
                     const auto& prev = values[i - 1];
                     const auto& cur = values[i];
-                    current_result = 1;
                     if (prev != cur) { // else 1
-                        for (current_result = 1;
-                             current_result <= static_cast<int>(std::min(prev.size(), cur.size()))
-                             && prev[current_result - 1] == cur[current_result - 1];
-                             current_result++) {}
+                        auto current_result = static_cast<reducer_value_t>(lcp::common_prefix_length(prev, cur)) + 1;
+                        result = std::max(result, current_result);
                     }
-                    result = std::max(result, current_result);
                 }
             }
             return result;
         }
 
     private:
-        std::ofstream f;
+        mapreduce::OutputSink& out;
         reducer_value_t result;
     };
 }
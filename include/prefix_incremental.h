@@ -0,0 +1,336 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "string_sort.h"
+#include "runner_stats.h"
+#include "lcp.h"
+
+namespace prefix_incremental {
+    // incremental version of the optimized algorithm: state with sorted distinct emails is kept between runs,
+    // each run adds only new emails (appended part of input file or stdin)
+    // - answer is max over adjacent distinct sorted emails of (common prefix + 1), at least 1
+    // - inserting email x between p and s only adds pairs (p, x) and (x, s), and the removed pair (p, s)
+    //   had shorter common prefix than both of them, so the answer is updated from neighbours of new emails alone
+    // - state directory keeps sorted runs of emails (one per line) like a log-structured merge tree:
+    //   each run adds a run of its new emails, the last runs are merged while the previous one is not much
+    //   bigger, so there are O(log n) runs and neighbours are found with binary search in memory mapped runs
+
+    // sorted distinct emails, one per line (the last line ends with '\n' too)
+    class SortedRun {
+    public:
+        explicit SortedRun(const std::string& filename_) :
+                filename(filename_), file(filename_), data(file.view()) {}
+
+        // looks for email, sets the last smaller and the first bigger emails (empty view if there is none)
+        bool find(std::string_view email, std::string_view& prev, std::string_view& next) const {
+            auto position = lower_bound(email);
+            prev = position == 0 ? std::string_view() : line_at(line_start(position - 1));
+            auto found = position < data.size() ? line_at(position) : std::string_view();
+            if (found == email) {
+                auto after = position + found.size() + 1;
+                next = after < data.size() ? line_at(after) : std::string_view();
+                return true;
+            }
+            next = found;
+            return false;
+        }
+
+        std::string_view view() const {
+            return data;
+        }
+
+        const std::string& name() const {
+            return filename;
+        }
+
+    private:
+        std::string filename;
+        mapreduce::MappedFile file;
+        std::string_view data;
+
+        std::string_view line_at(std::size_t start) const {
+            auto end = data.find('\n', start);
+            return data.substr(start, (end == std::string_view::npos ? data.size() : end) - start);
+        }
+
+        // start of line which contains position
+        std::size_t line_start(std::size_t position) const {
+            auto newline = position == 0 ? std::string_view::npos : data.rfind('\n', position - 1);
+            return newline == std::string_view::npos ? 0 : newline + 1;
+        }
+
+        // offset of the first line >= email (binary search over bytes: lines before lo are < email,
+        // lines starting at hi and later are >= email)
+        std::size_t lower_bound(std::string_view email) const {
+            std::size_t lo = 0;
+            std::size_t hi = data.size();
+            while (lo < hi) {
+                auto mid = lo + (hi - lo) / 2;
+                auto start = static_cast<std::size_t>(mapreduce::align_to_line_start(data, mid));
+                if (start >= hi) {
+                    hi = mid; // no line starts in [mid, hi)
+                    continue;
+                }
+                auto line = line_at(start);
+                if (line < email)
+                    lo = start + line.size() + 1;
+                else
+                    hi = start;
+            }
+            return lo;
+        }
+    };
+
+    // state of incremental runs in directory:
+    // - "state": answer, number of processed bytes of input file and list of runs
+    // - run files with sorted distinct emails
+    class PrefixState {
+    public:
+        explicit PrefixState(std::string directory_) : directory(std::move(directory_)) {
+            std::filesystem::create_directories(directory);
+            std::ifstream in(path("state"));
+            if (!in)
+                return; // new state
+            std::string header;
+            std::size_t num_runs = 0;
+            in >> header >> processed >> answer >> next_run >> num_runs;
+            if (!in || header != "yamr-incremental-1")
+                throw std::runtime_error("bad state file " + path("state"));
+            for (std::size_t i = 0; i < num_runs; i++) {
+                std::string run_name;
+                in >> run_name;
+                runs.push_back(std::make_unique<SortedRun>(path(run_name)));
+            }
+        }
+
+        // bytes of input file which were processed by previous runs
+        std::uint64_t processed_bytes() const {
+            return processed;
+        }
+
+        void set_processed_bytes(std::uint64_t processed_) {
+            processed = processed_;
+        }
+
+        // shortest unique prefix of all added emails, 0 if there are no emails
+        int result() const {
+            return answer;
+        }
+
+        // adds emails (any order, duplicates are allowed), views must be valid during the call
+        void add(std::vector<std::string_view> emails, mapreduce::ThreadPool& thread_pool) {
+            mapreduce::string_sort(emails, [](std::string_view email) { return email; }, &thread_pool);
+            emails.erase(std::unique(emails.begin(), emails.end()), emails.end());
+            if (emails.empty())
+                return;
+
+            // neighbours of each email among old and other new emails, in parallel over parts of emails
+            std::vector<char> is_new(emails.size(), false);
+            auto num_parts = std::min<std::size_t>(emails.size(), static_cast<std::size_t>(thread_pool.size()) * 4);
+            std::vector<int> part_results(num_parts, 1);
+            thread_pool.parallel_for(num_parts, [&](std::size_t part) {
+                for (auto i = emails.size() * part / num_parts; i < emails.size() * (part + 1) / num_parts; i++) {
+                    auto prev = i > 0 ? emails[i - 1] : std::string_view();
+                    auto next = i + 1 < emails.size() ? emails[i + 1] : std::string_view();
+                    bool found = false;
+                    for (const auto& run: runs) {
+                        std::string_view run_prev, run_next;
+                        found = run->find(emails[i], run_prev, run_next) || found;
+                        if (!run_prev.empty() && (prev.empty() || prev < run_prev))
+                            prev = run_prev;
+                        if (!run_next.empty() && (next.empty() || run_next < next))
+                            next = run_next;
+                    }
+                    if (found)
+                        continue;
+                    is_new[i] = true;
+                    auto& result = part_results[part];
+                    if (!prev.empty())
+                        result = std::max(result, static_cast<int>(lcp::common_prefix_length(prev, emails[i])) + 1);
+                    if (!next.empty())
+                        result = std::max(result, static_cast<int>(lcp::common_prefix_length(emails[i], next)) + 1);
+                }
+            });
+            for (auto result: part_results)
+                answer = std::max(answer, result);
+
+            auto run_name = "run_" + std::to_string(next_run++);
+            {
+                std::ofstream out(path(run_name), std::ios::binary);
+                for (std::size_t i = 0; i < emails.size(); i++)
+                    if (is_new[i])
+                        out << emails[i] << '\n';
+                if (!out)
+                    throw std::runtime_error("can't write " + path(run_name));
+            }
+            runs.push_back(std::make_unique<SortedRun>(path(run_name)));
+            compact();
+        }
+
+        // writes state file (atomically: runs listed in it are complete)
+        void save() const {
+            auto tmp_path = path("state.tmp");
+            {
+                std::ofstream out(tmp_path);
+                out << "yamr-incremental-1\n" << processed << "\n" << answer << "\n" << next_run << "\n"
+                    << runs.size() << "\n";
+                for (const auto& run: runs)
+                    out << std::filesystem::path(run->name()).filename().string() << "\n";
+                if (!out)
+                    throw std::runtime_error("can't write " + tmp_path);
+            }
+            std::filesystem::rename(tmp_path, path("state"));
+            // runs which are not listed (merged into bigger ones) are not needed anymore
+            for (const auto& entry: std::filesystem::directory_iterator(directory)) {
+                auto name = entry.path().filename().string();
+                if (name.rfind("run_", 0) == 0 &&
+                    std::none_of(runs.begin(), runs.end(), [&](const auto& run) { return run->name() == path(name); }))
+                    std::filesystem::remove(entry.path());
+            }
+        }
+
+    private:
+        static constexpr std::size_t merge_ratio = 2;
+
+        std::string directory;
+        std::uint64_t processed = 0;
+        int answer = 0;
+        std::uint64_t next_run = 0;
+        std::vector<std::unique_ptr<SortedRun>> runs;
+
+        std::string path(const std::string& name) const {
+            return (std::filesystem::path(directory) / name).string();
+        }
+
+        // merges the last runs while the previous run is less than merge_ratio times bigger than the last one
+        void compact() {
+            while (runs.size() > 1 &&
+                   runs[runs.size() - 2]->view().size() <= merge_ratio * runs.back()->view().size()) {
+                auto run_name = "run_" + std::to_string(next_run++);
+                merge(*runs[runs.size() - 2], *runs.back(), path(run_name));
+                runs.pop_back();
+                runs.back() = std::make_unique<SortedRun>(path(run_name));
+            }
+        }
+
+        // runs have no common emails
+        static void merge(const SortedRun& lhs, const SortedRun& rhs, const std::string& filename) {
+            std::ofstream out(filename, std::ios::binary);
+            auto left = lhs.view();
+            auto right = rhs.view();
+            while (!left.empty() && !right.empty()) {
+                auto left_line = left.substr(0, left.find('\n') + 1);
+                auto right_line = right.substr(0, right.find('\n') + 1);
+                if (left_line < right_line) {
+                    out << left_line;
+                    left.remove_prefix(left_line.size());
+                } else {
+                    out << right_line;
+                    right.remove_prefix(right_line.size());
+                }
+            }
+            out << left << right;
+            if (!out)
+                throw std::runtime_error("can't write " + filename);
+        }
+    };
+
+    // processes new records of input with state in state_directory:
+    // - file: part of file after processed bytes up to the last complete line
+    //   (incomplete last line of appended file is processed by the next run)
+    // - "-": all records from stdin
+    class IncrementalPrefixEngine {
+    public:
+        IncrementalPrefixEngine(std::string filename_, std::string state_directory_, int num_threads_) :
+                filename(std::move(filename_)),
+                state_directory(std::move(state_directory_)),
+                num_threads(num_threads_) {}
+
+        // workers are pinned to cpus, filling one NUMA node before the next one (see ThreadPool)
+        void set_pin_threads(bool pin_threads_) {
+            pin_threads = pin_threads_;
+        }
+
+        // returns vector with one result (or empty vector if there are no emails yet), like MapReduceRunner
+        std::vector<int> process() {
+            run_stats = mapreduce::RunnerStats();
+            mapreduce::ThreadPool thread_pool(num_threads, pin_threads);
+            run_stats.unpinned_workers = thread_pool.pinning_failures();
+            std::unique_ptr<PrefixState> state;
+            run_phase("load", [&] { state = std::make_unique<PrefixState>(state_directory); });
+
+            std::unique_ptr<mapreduce::MappedFile> mapped_file;
+            std::string input; // stdin
+            std::string_view data;
+            std::uint64_t start = 0;
+            run_phase("read", [&] {
+                if (filename == "-") {
+                    std::ostringstream buffer;
+                    buffer << std::cin.rdbuf();
+                    input = std::move(buffer).str();
+                    data = input;
+                } else {
+                    mapped_file = std::make_unique<mapreduce::MappedFile>(filename);
+                    auto whole = mapped_file->view();
+                    start = state->processed_bytes();
+                    if (start > whole.size())
+                        throw std::runtime_error("input " + filename + " is shorter than its processed part, "
+                                                 "remove state " + state_directory + " to start from scratch");
+                    data = whole.substr(0, whole.rfind('\n') == std::string_view::npos ? 0 : whole.rfind('\n') + 1);
+                    start = std::min<std::uint64_t>(start, data.size());
+                }
+            });
+
+            std::vector<std::string_view> emails;
+            mapreduce::MapTaskStats task_stats;
+            mapreduce::for_each_record(data, start, data.size(), [&](std::string_view email) {
+                task_stats.records++;
+                task_stats.bytes += email.size();
+                emails.push_back(email);
+            });
+            run_stats.map_tasks.push_back(task_stats);
+
+            run_phase("merge", [&] { state->add(std::move(emails), thread_pool); });
+            run_phase("save", [&] {
+                if (filename != "-")
+                    state->set_processed_bytes(data.size());
+                state->save();
+            });
+            run_stats.peak_rss_bytes = mapreduce::peak_rss_bytes();
+            if (state->result() == 0)
+                return {};
+            return {state->result()};
+        }
+
+        // statistics of the last process() call
+        const mapreduce::RunnerStats& stats() const {
+            return run_stats;
+        }
+
+    private:
+        const std::string filename;
+        const std::string state_directory;
+        int num_threads;
+        bool pin_threads = false;
+        mapreduce::RunnerStats run_stats;
+
+        template<typename Func>
+        void run_phase(const std::string& name, Func func) {
+            mapreduce::Stopwatch stopwatch;
+            func();
+            run_stats.phases.push_back({name, stopwatch.wall_seconds(), stopwatch.cpu_seconds()});
+        }
+    };
+}
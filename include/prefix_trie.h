@@ -0,0 +1,287 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <tuple>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "runner_stats.h"
+#include "lcp.h"
+
+namespace prefix_trie {
+    // sort-free engine for the same task as prefix functors:
+    // - each map task builds radix trie of its emails (nodes are stored in one arena, labels point into mapped file)
+    // - tries are merged pairwise in parallel: paths of both tries are walked together, subtrees which are
+    //   only in one of them are copied without inserting their emails again (labels stay views)
+    // - answer is (depth of the deepest node where distinct emails branch) + 1,
+    //   duplicated emails don't branch, so if all emails are equal the answer is 1
+
+    class RadixTrie {
+    public:
+        RadixTrie() {
+            nodes.emplace_back(); // root
+        }
+
+        void insert(std::string_view email) {
+            std::uint32_t node_idx = root;
+            std::size_t depth = 0;
+            while (true) {
+                if (depth == email.size()) {
+                    nodes[node_idx].terminal = true;
+                    return;
+                }
+
+                auto child_idx = find_child(node_idx, email[depth]);
+                if (child_idx == none) {
+                    auto leaf_idx = new_node(email.substr(depth));
+                    nodes[leaf_idx].terminal = true;
+                    add_child(node_idx, leaf_idx);
+                    return;
+                }
+
+                auto label = nodes[child_idx].label;
+                auto rest = email.substr(depth);
+                auto common = lcp::common_prefix_length(label, rest);
+                if (common < label.size())
+                    child_idx = split_edge(node_idx, child_idx, common);
+                node_idx = child_idx;
+                depth += common;
+            }
+        }
+
+        // adds all emails of other trie: nodes of both tries with the same path are merged,
+        // children of other node with a new first symbol are copied as whole subtrees
+        void merge(const RadixTrie& other) {
+            // stack: <node of this trie, node of other trie, symbols of other node's label already matched>,
+            // other node is merged as a child of this node (or into it when all its label is matched)
+            std::vector<std::tuple<std::uint32_t, std::uint32_t, std::size_t>> stack;
+            auto merge_into = [&](std::uint32_t node_idx, std::uint32_t other_idx) {
+                const auto& other_node = other.nodes[other_idx];
+                if (other_node.terminal)
+                    nodes[node_idx].terminal = true;
+                for (std::uint32_t i = 0; i < other_node.num_children; i++)
+                    stack.emplace_back(node_idx, other.child_nodes[other_node.children + i], 0);
+            };
+            merge_into(root, root);
+            while (!stack.empty()) {
+                auto [parent_idx, other_idx, matched] = stack.back();
+                stack.pop_back();
+                auto rest = other.nodes[other_idx].label.substr(matched);
+                if (rest.empty()) {
+                    merge_into(parent_idx, other_idx);
+                    continue;
+                }
+                auto child_idx = find_child(parent_idx, rest[0]);
+                if (child_idx == none) {
+                    auto copy_idx = copy_subtree(other, other_idx);
+                    nodes[copy_idx].label = rest;
+                    add_child(parent_idx, copy_idx);
+                    continue;
+                }
+                auto common = lcp::common_prefix_length(nodes[child_idx].label, rest);
+                if (common < nodes[child_idx].label.size())
+                    child_idx = split_edge(parent_idx, child_idx, common);
+                stack.emplace_back(child_idx, other_idx, matched + common);
+            }
+        }
+
+        bool empty() const {
+            return nodes.size() == 1 && !nodes[root].terminal;
+        }
+
+        // length of the shortest prefix which identifies all distinct emails
+        int shortest_unique_prefix() const {
+            int result = 1;
+            // depth first search with explicit stack: pairs <node, depth of node>
+            std::vector<std::pair<std::uint32_t, std::size_t>> stack{{root, 0}};
+            while (!stack.empty()) {
+                auto [node_idx, depth] = stack.back();
+                stack.pop_back();
+                const auto& node = nodes[node_idx];
+                for (std::uint32_t i = 0; i < node.num_children; i++) {
+                    auto child_idx = child_nodes[node.children + i];
+                    stack.emplace_back(child_idx, depth + nodes[child_idx].label.size());
+                }
+                if (node.num_children + (node.terminal ? 1 : 0) > 1)
+                    result = std::max(result, static_cast<int>(depth) + 1);
+            }
+            return result;
+        }
+
+    private:
+        static constexpr std::uint32_t none = UINT32_MAX;
+        static constexpr std::uint32_t root = 0;
+
+        struct Node {
+            std::string_view label; // edge from parent
+            std::uint32_t children = 0; // position of children in child_symbols and child_nodes
+            std::uint16_t num_children = 0;
+            std::uint16_t children_capacity = 0;
+            bool terminal = false;
+        };
+
+        // arena: nodes reference each other by index,
+        // children of a node are stored contiguously: first symbols of labels (to find child with memchr) and indices
+        std::vector<Node> nodes;
+        std::vector<char> child_symbols;
+        std::vector<std::uint32_t> child_nodes;
+
+        std::uint32_t new_node(std::string_view label) {
+            nodes.emplace_back();
+            nodes.back().label = label;
+            return static_cast<std::uint32_t>(nodes.size() - 1);
+        }
+
+        // copies subtree of other trie to this one, returns index of the copy of its root
+        std::uint32_t copy_subtree(const RadixTrie& other, std::uint32_t other_idx) {
+            auto copy_idx = new_node(other.nodes[other_idx].label);
+            nodes[copy_idx].terminal = other.nodes[other_idx].terminal;
+            // stack: <node of other trie, its copy>, children are added to the copy of their parent
+            std::vector<std::pair<std::uint32_t, std::uint32_t>> stack{{other_idx, copy_idx}};
+            while (!stack.empty()) {
+                auto [from_idx, to_idx] = stack.back();
+                stack.pop_back();
+                const auto& from = other.nodes[from_idx];
+                for (std::uint32_t i = 0; i < from.num_children; i++) {
+                    auto child_idx = other.child_nodes[from.children + i];
+                    auto child_copy_idx = new_node(other.nodes[child_idx].label);
+                    nodes[child_copy_idx].terminal = other.nodes[child_idx].terminal;
+                    add_child(to_idx, child_copy_idx);
+                    stack.emplace_back(child_idx, child_copy_idx);
+                }
+            }
+            return copy_idx;
+        }
+
+        std::uint32_t find_child(std::uint32_t node_idx, char first) const {
+            const auto& node = nodes[node_idx];
+            if (node.num_children == 0)
+                return none;
+            auto symbols = child_symbols.data() + node.children;
+            auto found = static_cast<const char *>(std::memchr(symbols, first, node.num_children));
+            return found == nullptr ? none : child_nodes[node.children + (found - symbols)];
+        }
+
+        void add_child(std::uint32_t parent_idx, std::uint32_t child_idx) {
+            auto& parent = nodes[parent_idx];
+            if (parent.num_children == parent.children_capacity) {
+                // children don't fit: move them to the end of arena with doubled capacity
+                auto capacity = std::min<std::uint32_t>(256, std::max<std::uint32_t>(2, 2u * parent.children_capacity));
+                auto position = static_cast<std::uint32_t>(child_symbols.size());
+                child_symbols.resize(position + capacity);
+                child_nodes.resize(position + capacity);
+                std::copy_n(child_symbols.begin() + parent.children, parent.num_children,
+                            child_symbols.begin() + position);
+                std::copy_n(child_nodes.begin() + parent.children, parent.num_children,
+                            child_nodes.begin() + position);
+                parent.children = position;
+                parent.children_capacity = static_cast<std::uint16_t>(capacity);
+            }
+            child_symbols[parent.children + parent.num_children] = nodes[child_idx].label[0];
+            child_nodes[parent.children + parent.num_children] = child_idx;
+            parent.num_children++;
+        }
+
+        // splits edge parent -> child after label_length symbols, returns new middle node
+        std::uint32_t split_edge(std::uint32_t parent_idx, std::uint32_t child_idx, std::size_t label_length) {
+            auto label = nodes[child_idx].label;
+            auto middle_idx = new_node(label.substr(0, label_length));
+            // middle node replaces child in the list of parent's children (first symbol is the same)
+            const auto& parent = nodes[parent_idx];
+            for (std::uint32_t i = parent.children; i < parent.children + parent.num_children; i++)
+                if (child_nodes[i] == child_idx)
+                    child_nodes[i] = middle_idx;
+            nodes[child_idx].label = label.substr(label_length);
+            add_child(middle_idx, child_idx);
+            return middle_idx;
+        }
+    };
+
+    class ShortestPrefixEngine {
+    public:
+        ShortestPrefixEngine(std::string filename_, int num_threads_map_, int num_threads_reduce_) :
+                filename(std::move(filename_)),
+                num_threads_map(num_threads_map_),
+                num_threads_reduce(num_threads_reduce_) {}
+
+        // workers are pinned to cpus, filling one NUMA node before the next one (see ThreadPool)
+        void set_pin_threads(bool pin_threads_) {
+            pin_threads = pin_threads_;
+        }
+
+        // returns vector with one result (or empty vector for file without emails), like MapReduceRunner
+        std::vector<int> process() {
+            run_stats = mapreduce::RunnerStats();
+            mapreduce::ThreadPool thread_pool(std::max(num_threads_map, num_threads_reduce), pin_threads);
+            run_stats.unpinned_workers = thread_pool.pinning_failures();
+            std::unique_ptr<mapreduce::MappedFile> mapped_file;
+            run_phase("split", [&] { mapped_file = std::make_unique<mapreduce::MappedFile>(filename); });
+            auto data = mapped_file->view();
+            auto num_tasks = std::min<std::uint64_t>(num_threads_map, std::max<std::uint64_t>(data.size(), 1));
+
+            // map: trie for each part of file
+            std::vector<RadixTrie> tries(num_tasks);
+            run_stats.map_tasks.resize(num_tasks);
+            run_phase("map", [&] {
+                thread_pool.parallel_for(num_tasks, [&](std::size_t i) {
+                    mapreduce::Stopwatch stopwatch(CLOCK_THREAD_CPUTIME_ID);
+                    auto& task_stats = run_stats.map_tasks[i];
+                    auto start = mapreduce::align_to_line_start(data, data.size() * i / num_tasks);
+                    auto end = mapreduce::align_to_line_start(data, data.size() * (i + 1) / num_tasks);
+                    mapreduce::for_each_record(data, start, end, [&](std::string_view email) {
+                        task_stats.records++;
+                        task_stats.bytes += email.size();
+                        tries[i].insert(email);
+                    });
+                    task_stats.worker = thread_pool.worker_index();
+                    task_stats.wall_seconds = stopwatch.wall_seconds();
+                    task_stats.cpu_seconds = stopwatch.cpu_seconds();
+                });
+            });
+
+            // merge: tree of pairwise merges, tries of one level are merged in parallel
+            run_phase("merge", [&] {
+                for (std::size_t step = 1; step < tries.size(); step *= 2) {
+                    auto num_merges = (tries.size() + 2 * step - 1) / (2 * step);
+                    thread_pool.parallel_for(num_merges, [&](std::size_t k) {
+                        auto i = 2 * step * k;
+                        if (i + step < tries.size()) {
+                            tries[i].merge(tries[i + step]);
+                            tries[i + step] = RadixTrie();
+                        }
+                    });
+                }
+            });
+
+            std::vector<int> result;
+            if (!tries.empty() && !tries[0].empty())
+                run_phase("reduce", [&] { result.push_back(tries[0].shortest_unique_prefix()); });
+            run_stats.peak_rss_bytes = mapreduce::peak_rss_bytes();
+            return result;
+        }
+
+        // statistics of the last process() call (there are no pairs and reduce tasks)
+        const mapreduce::RunnerStats& stats() const {
+            return run_stats;
+        }
+
+    private:
+        const std::string filename;
+        int num_threads_map;
+        int num_threads_reduce;
+        bool pin_threads = false;
+        mapreduce::RunnerStats run_stats;
+
+        template<typename Func>
+        void run_phase(const std::string& name, Func func) {
+            mapreduce::Stopwatch stopwatch;
+            func();
+            run_stats.phases.push_back({name, stopwatch.wall_seconds(), stopwatch.cpu_seconds()});
+        }
+    };
+}
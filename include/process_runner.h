@@ -0,0 +1,751 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <cstdint>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "map_reduce_runner.h"
+
+namespace mapreduce {
+    // shuffle files are read by other processes, so unlike packed runs in memory they can't refer to addresses:
+    // string_views are stored as bytes and decoded as views into mapped file, other types as in packed runs
+    template<typename T>
+    struct PortableCodec : PackedCodec<T> {
+    };
+
+    template<>
+    struct PortableCodec<std::string_view> {
+        static std::size_t max_size(std::string_view value) {
+            return max_varint_size + value.size();
+        }
+
+        void encode(char *& out, std::string_view value) {
+            write_varint(out, value.size());
+            std::memcpy(out, value.data(), value.size());
+            out += value.size();
+        }
+
+        void decode(const char *& in, std::string_view& value) {
+            auto size = read_varint(in);
+            value = std::string_view(in, size);
+            in += size;
+        }
+    };
+
+    // pair of shuffle file: when key and value are views and key is a prefix of value in the same memory
+    // (as in prefix mappers), only size of key is stored
+    template<typename Pair>
+    class ShuffleFormat {
+    public:
+        static std::size_t max_size(const Pair& elem) {
+            return PortableCodec<typename Pair::first_type>::max_size(elem.first) +
+                   PortableCodec<typename Pair::second_type>::max_size(elem.second);
+        }
+
+        void encode(char *& out, const Pair& elem) {
+            if constexpr (value_relative_to_key<Pair>) {
+                bool shared = elem.first.data() == elem.second.data() && elem.first.size() <= elem.second.size();
+                write_varint(out, elem.first.size() * 2 + shared);
+                value_codec.encode(out, elem.second);
+                if (!shared) {
+                    std::memcpy(out, elem.first.data(), elem.first.size());
+                    out += elem.first.size();
+                }
+            } else {
+                key_codec.encode(out, elem.first);
+                value_codec.encode(out, elem.second);
+            }
+        }
+
+        void decode(const char *& in, Pair& elem) {
+            if constexpr (value_relative_to_key<Pair>) {
+                auto header = read_varint(in);
+                value_codec.decode(in, elem.second);
+                if (header & 1) {
+                    elem.first = elem.second.substr(0, header / 2);
+                } else {
+                    elem.first = std::string_view(in, header / 2);
+                    in += header / 2;
+                }
+            } else {
+                key_codec.decode(in, elem.first);
+                value_codec.decode(in, elem.second);
+            }
+        }
+
+    private:
+        PortableCodec<typename Pair::first_type> key_codec;
+        PortableCodec<typename Pair::second_type> value_codec;
+    };
+
+    // writes sorted pairs to shuffle file, the file appears under its name only when it is complete
+    // (several attempts of a task can write the same file)
+    template<typename Pair>
+    void write_shuffle_file(const std::string& filename, const std::vector<Pair>& pairs) {
+        std::vector<char> bytes;
+        ShuffleFormat<Pair> format;
+        for (const auto& elem: pairs) {
+            auto size = bytes.size();
+            bytes.resize(size + format.max_size(elem));
+            auto position = bytes.data() + size;
+            format.encode(position, elem);
+            bytes.resize(static_cast<std::size_t>(position - bytes.data()));
+        }
+        auto tmp_filename = filename + "." + std::to_string(::getpid()) + ".tmp";
+        {
+            std::ofstream out(tmp_filename, std::ios::binary);
+            out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            out.close();
+            if (!out)
+                throw std::runtime_error("can't write shuffle file " + tmp_filename);
+        }
+        std::filesystem::rename(tmp_filename, filename);
+    }
+
+    // shuffle file of a map task for a partition, decoded views point into the mapping
+    template<typename Pair>
+    class ShuffleRun : public SortedRun<Pair> {
+    public:
+        explicit ShuffleRun(const std::string& filename) : file(filename), data(file.view()), position(data.data()) {}
+
+        bool next(Pair& elem) override {
+            if (position == data.data() + data.size())
+                return false;
+            format.decode(position, elem);
+            return true;
+        }
+
+    private:
+        MappedFile file;
+        std::string_view data;
+        const char *position;
+        ShuffleFormat<Pair> format;
+    };
+
+    // runs map and reduce tasks in worker processes instead of threads:
+    // - coordinator (the process which calls process()) forks workers and sends them tasks over socket pairs,
+    //   one text line per command ("map <task> <start> <end>", "reduce <partition>", "quit") and per reply
+    //   ("done <task stats>" or "error <message>")
+    // - map task writes a shuffle file for each partition to work directory, reduce task merges shuffle files
+    //   of its partition, writes output file and its result, so workers share only the disk
+    //   (with memory budget a map task writes a run of shuffle files each time it exceeds the budget,
+    //   reduce command lists numbers of runs of map tasks: "reduce <partition> <runs of task 0> ...")
+    // - a crash of map or reduce function kills only its worker: worker is restarted, task is executed again
+    //   (up to max_attempts times); when a task runs much longer than finished ones, an idle worker runs
+    //   a backup attempt, and the first finished attempt wins
+    // results and output files are the same as of MapReduceRunner with the same template arguments
+    template<typename MapCls, typename ReduceCls,
+            typename PartitionCls = HashPartitioner,
+            typename CombineCls = NoCombiner>
+    class ProcessRunner {
+    public:
+        using runner_t = MapReduceRunner<MapCls, ReduceCls, PartitionCls, CombineCls>;
+        using map_result_t = typename runner_t::map_result_t;
+        using map_key_t = typename runner_t::map_key_t;
+        using map_value_t = typename runner_t::map_value_t;
+        using reduce_result_t = typename runner_t::reduce_result_t;
+
+        ProcessRunner(
+                std::string filename_,
+                int num_workers_map_,
+                int num_workers_reduce_,
+                std::string path_to_save_reduce_files_ = "") :
+                filename(std::move(filename_)),
+                num_workers_map(std::max(num_workers_map_, 1)),
+                num_workers_reduce(std::max(num_workers_reduce_, 1)),
+                path_to_save_reduce_files(std::move(path_to_save_reduce_files_)) {}
+
+        ProcessRunner(const ProcessRunner&) = delete;
+        ProcessRunner& operator=(const ProcessRunner&) = delete;
+
+        ~ProcessRunner() {
+            stop_workers();
+        }
+
+        // map input is split into num_workers_map * tasks_per_worker tasks,
+        // there is one partition (reduce task and output file) per reduce worker
+        void set_tasks_per_worker(int tasks_per_worker_) {
+            tasks_per_worker = std::max(tasks_per_worker_, 1);
+        }
+
+        void set_output_format(OutputFormat output_format_) {
+            output_format = output_format_;
+        }
+
+        // limits memory for map results of each map task (approximately, in bytes), as in MapReduceRunner:
+        // when limit is exceeded, sorted buckets are written as a run of shuffle files, 0 - no limit
+        void set_memory_budget(std::size_t memory_budget_per_map_task) {
+            memory_budget = memory_budget_per_map_task;
+        }
+
+        // shuffle files are written to temporary directory in work_path (system temporary directory by default)
+        void set_work_path(std::string work_path_) {
+            work_path = std::move(work_path_);
+        }
+
+        // task is executed at most max_attempts times, then process() throws
+        void set_max_attempts(int max_attempts_) {
+            max_attempts = std::max(max_attempts_, 1);
+        }
+
+        // backup attempt is started when task runs longer than both min_seconds and twice the mean time
+        // of finished tasks of the phase
+        void set_backup_after(double min_seconds) {
+            backup_min_seconds = min_seconds;
+        }
+
+        std::vector<reduce_result_t> process() {
+            run_stats = RunnerStats();
+            failed_attempts = 0;
+            backup_attempts = 0;
+            auto size = static_cast<std::uint64_t>(std::filesystem::file_size(filename));
+            work_directory = std::make_unique<TempDirectory>(work_path);
+            num_map_tasks = static_cast<std::size_t>(std::min<std::uint64_t>(
+                    static_cast<std::uint64_t>(num_workers_map) * tasks_per_worker, std::max<std::uint64_t>(size, 1)));
+            num_partitions = static_cast<std::size_t>(num_workers_reduce);
+            run_stats.map_tasks.assign(num_map_tasks, MapTaskStats());
+            run_stats.reduce_tasks.assign(num_partitions, ReduceTaskStats());
+
+            std::vector<Task> map_tasks(num_map_tasks);
+            for (std::size_t i = 0; i < num_map_tasks; i++)
+                map_tasks[i].command = "map " + std::to_string(i) + " " + std::to_string(size * i / num_map_tasks) +
+                                       " " + std::to_string(size * (i + 1) / num_map_tasks);
+            std::vector<Task> reduce_tasks(num_partitions);
+            map_task_runs.assign(num_map_tasks, 0);
+
+            std::vector<char> has_result(num_partitions, false);
+            try {
+                workers.resize(static_cast<std::size_t>(std::max(num_workers_map, num_workers_reduce)));
+                for (auto& worker: workers)
+                    start_worker(worker);
+                run_phase("map", [&] {
+                    run_tasks(map_tasks, [this](std::size_t task_idx, int worker_idx, std::istream& reply) {
+                        auto& task_stats = run_stats.map_tasks[task_idx];
+                        task_stats.worker = worker_idx;
+                        reply >> task_stats.records >> task_stats.bytes >> task_stats.pairs_emitted
+                              >> task_stats.pairs_shuffled >> task_stats.wall_seconds >> task_stats.cpu_seconds
+                              >> task_stats.spilled_runs >> map_task_runs[task_idx];
+                    });
+                });
+                for (std::size_t i = 0; i < num_partitions; i++) {
+                    reduce_tasks[i].command = "reduce " + std::to_string(i);
+                    for (auto runs: map_task_runs)
+                        reduce_tasks[i].command += " " + std::to_string(runs);
+                }
+                run_phase("reduce", [&] {
+                    run_tasks(reduce_tasks, [&](std::size_t task_idx, int worker_idx, std::istream& reply) {
+                        auto& task_stats = run_stats.reduce_tasks[task_idx];
+                        task_stats.worker = worker_idx;
+                        int result_flag = 0;
+                        std::size_t histogram_size = 0;
+                        reply >> result_flag >> task_stats.keys >> task_stats.pairs >> task_stats.wall_seconds
+                              >> task_stats.cpu_seconds >> task_stats.reduce_call_seconds >> histogram_size;
+                        task_stats.key_group_histogram.resize(histogram_size);
+                        for (auto& count: task_stats.key_group_histogram)
+                            reply >> count;
+                        has_result[task_idx] = result_flag != 0;
+                    });
+                });
+            } catch (...) {
+                stop_workers();
+                work_directory.reset();
+                throw;
+            }
+            stop_workers();
+
+            // empty partitions have no reducer and no result
+            std::vector<reduce_result_t> results;
+            for (std::size_t i = 0; i < num_partitions; i++) {
+                if (!has_result[i])
+                    continue;
+                MappedFile result_file(work_file("result_" + std::to_string(i)));
+                auto position = result_file.view().data();
+                reduce_result_t result{};
+                PortableCodec<reduce_result_t>().decode(position, result);
+                results.push_back(std::move(result));
+            }
+            for (const auto& task_stats: run_stats.reduce_tasks) {
+                auto& histogram = run_stats.key_group_histogram;
+                if (histogram.size() < task_stats.key_group_histogram.size())
+                    histogram.resize(task_stats.key_group_histogram.size(), 0);
+                for (std::size_t k = 0; k < task_stats.key_group_histogram.size(); k++)
+                    histogram[k] += task_stats.key_group_histogram[k];
+            }
+            rusage usage{};
+            getrusage(RUSAGE_CHILDREN, &usage); // the biggest worker
+            run_stats.peak_rss_bytes = std::max(peak_rss_bytes(), static_cast<std::uint64_t>(usage.ru_maxrss) * 1024);
+            work_directory.reset();
+            return results;
+        }
+
+        // statistics of the last process() call, worker of task is index of worker process
+        // (phase cpu time is of coordinator only, cpu time of tasks is measured by workers)
+        const RunnerStats& stats() const {
+            return run_stats;
+        }
+
+        // attempts of the last process() call which failed (worker crashed or task threw exception)
+        std::size_t failed_attempts_count() const {
+            return failed_attempts;
+        }
+
+        // backup attempts of slow tasks started by the last process() call
+        std::size_t backup_attempts_count() const {
+            return backup_attempts;
+        }
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct Task {
+            std::string command;
+            bool done = false;
+            int running = 0;  // attempts which are running now
+            int failures = 0;
+            clock::time_point started{};
+        };
+
+        struct Worker {
+            pid_t pid = -1;
+            int fd = -1;            // coordinator end of socket pair
+            std::string input;      // incomplete reply
+            int task = -1;          // task of current phase, -1 if worker is idle
+        };
+
+        const std::string filename;
+        const int num_workers_map;
+        const int num_workers_reduce;
+        const std::string path_to_save_reduce_files;
+        int tasks_per_worker = 4;
+        std::size_t memory_budget = 0;
+        OutputFormat output_format = OutputFormat::text;
+        std::string work_path;
+        int max_attempts = 3;
+        double backup_min_seconds = 1.0;
+
+        std::unique_ptr<TempDirectory> work_directory;
+        std::size_t num_map_tasks = 0;
+        std::size_t num_partitions = 0;
+        std::vector<std::size_t> map_task_runs; // runs of shuffle files written by each map task
+        std::vector<Worker> workers;
+        std::size_t failed_attempts = 0;
+        std::size_t backup_attempts = 0;
+        RunnerStats run_stats;
+
+        // in worker process: input file is mapped once for all map tasks
+        std::unique_ptr<MappedFile> mapped_file;
+
+        template<typename Func>
+        void run_phase(const std::string& name, Func func) {
+            Stopwatch stopwatch;
+            func();
+            run_stats.phases.push_back({name, stopwatch.wall_seconds(), stopwatch.cpu_seconds()});
+        }
+
+        std::string work_file(const std::string& name) const {
+            return work_directory->file(name);
+        }
+
+        std::string shuffle_file(std::size_t map_task, std::size_t partition, std::size_t run) const {
+            return work_file("map_" + std::to_string(map_task) + "_part_" + std::to_string(partition) + "_" +
+                             std::to_string(run) + ".run");
+        }
+
+        std::string output_path(std::size_t partition) const {
+            return path_to_save_reduce_files + "reduce_" + std::to_string(partition);
+        }
+
+        // output file of an attempt is renamed to output file of partition when attempt is done
+        std::string attempt_output_path(std::size_t partition, pid_t pid) const {
+            return output_path(partition) + ".attempt" + std::to_string(pid);
+        }
+
+        static std::string output_file_extension(OutputFormat format) {
+            if constexpr (std::is_constructible_v<ReduceCls, OutputSink&>)
+                return output_extension(format);
+            else
+                return ".txt"; // reducers which create "<name>.txt" themselves
+        }
+
+        static void send_line(int fd, const std::string& line) {
+            auto data = line + "\n";
+            std::size_t sent = 0;
+            while (sent < data.size()) {
+                auto count = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (count < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    throw std::system_error(errno, std::generic_category(), "can't send to worker");
+                }
+                sent += static_cast<std::size_t>(count);
+            }
+        }
+
+        // reads available data to buffer, returns false at end of stream or error
+        static bool receive(int fd, std::string& buffer) {
+            char block[4096];
+            while (true) {
+                auto count = ::read(fd, block, sizeof(block));
+                if (count < 0 && errno == EINTR)
+                    continue;
+                if (count <= 0)
+                    return false;
+                buffer.append(block, static_cast<std::size_t>(count));
+                return true;
+            }
+        }
+
+        static bool take_line(std::string& buffer, std::string& line) {
+            auto newline = buffer.find('\n');
+            if (newline == std::string::npos)
+                return false;
+            line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            return true;
+        }
+
+        void start_worker(Worker& worker) {
+            int fds[2];
+            if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+                throw std::system_error(errno, std::generic_category(), "can't create socket pair");
+            auto pid = ::fork();
+            if (pid < 0) {
+                int err = errno;
+                ::close(fds[0]);
+                ::close(fds[1]);
+                throw std::system_error(err, std::generic_category(), "can't start worker process");
+            }
+            if (pid == 0) {
+                ::close(fds[0]);
+                for (const auto& other: workers)
+                    if (other.fd >= 0)
+                        ::close(other.fd);
+                ::_exit(worker_main(fds[1])); // no atexit handlers and stdio flushes of the coordinator
+            }
+            ::close(fds[1]);
+            worker.pid = pid;
+            worker.fd = fds[0];
+            worker.input.clear();
+            worker.task = -1;
+        }
+
+        // kills worker (if it is still running) and waits for it
+        void finish_worker(Worker& worker, bool kill) {
+            if (worker.pid < 0)
+                return;
+            if (kill)
+                ::kill(worker.pid, SIGKILL);
+            ::close(worker.fd);
+            int status = 0;
+            while (::waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+            }
+            worker.pid = -1;
+            worker.fd = -1;
+            worker.task = -1;
+        }
+
+        void stop_workers() noexcept {
+            for (auto& worker: workers) {
+                if (worker.pid < 0)
+                    continue;
+                bool busy = worker.task >= 0;
+                if (!busy) {
+                    try {
+                        send_line(worker.fd, "quit");
+                    } catch (...) {
+                        busy = true; // can't ask it to stop
+                    }
+                }
+                finish_worker(worker, busy);
+            }
+            workers.clear();
+        }
+
+        // runs tasks of a phase on workers, parse_reply(task, worker, reply) reads stats of the first
+        // finished attempt of each task
+        template<typename ParseReply>
+        void run_tasks(std::vector<Task>& tasks, ParseReply parse_reply) {
+            std::deque<std::size_t> pending(tasks.size());
+            std::iota(pending.begin(), pending.end(), 0);
+            std::size_t num_done = 0;
+            double done_seconds = 0; // total time of finished tasks
+
+            auto assign = [&](Worker& worker, std::size_t task_idx) {
+                auto& task = tasks[task_idx];
+                if (task.running == 0)
+                    task.started = clock::now();
+                task.running++;
+                worker.task = static_cast<int>(task_idx);
+                send_line(worker.fd, task.command);
+            };
+            auto failed = [&](std::size_t task_idx, const std::string& message) {
+                auto& task = tasks[task_idx];
+                task.running--;
+                failed_attempts++;
+                if (task.done)
+                    return;
+                if (++task.failures >= max_attempts)
+                    throw std::runtime_error("task \"" + task.command + "\" failed " + std::to_string(task.failures) +
+                                             " times, the last error: " + message);
+                if (task.running == 0)
+                    pending.push_back(task_idx);
+            };
+            // a task which runs much longer than finished ones and has no backup attempt yet
+            auto slow_task = [&]() -> int {
+                if (num_done == 0)
+                    return -1;
+                auto threshold = std::max(backup_min_seconds, 2 * done_seconds / static_cast<double>(num_done));
+                int slowest = -1;
+                double slowest_seconds = threshold;
+                for (std::size_t i = 0; i < tasks.size(); i++) {
+                    if (tasks[i].done || tasks[i].running != 1)
+                        continue;
+                    auto seconds = std::chrono::duration<double>(clock::now() - tasks[i].started).count();
+                    if (seconds > slowest_seconds) {
+                        slowest = static_cast<int>(i);
+                        slowest_seconds = seconds;
+                    }
+                }
+                return slowest;
+            };
+            auto worker_lost = [&](Worker& worker) {
+                auto task_idx = worker.task;
+                auto pid = worker.pid;
+                finish_worker(worker, true);
+                start_worker(worker);
+                if (task_idx >= 0)
+                    failed(static_cast<std::size_t>(task_idx), "worker process " + std::to_string(pid) + " exited");
+            };
+
+            while (num_done < tasks.size()) {
+                for (auto& worker: workers) {
+                    if (worker.task >= 0)
+                        continue;
+                    while (!pending.empty() && tasks[pending.front()].done)
+                        pending.pop_front();
+                    int task_idx = -1;
+                    if (!pending.empty()) {
+                        task_idx = static_cast<int>(pending.front());
+                        pending.pop_front();
+                    } else if ((task_idx = slow_task()) >= 0) {
+                        backup_attempts++;
+                    } else {
+                        break;
+                    }
+                    try {
+                        assign(worker, static_cast<std::size_t>(task_idx));
+                    } catch (const std::system_error&) {
+                        worker_lost(worker);
+                    }
+                }
+
+                std::vector<pollfd> fds;
+                for (const auto& worker: workers)
+                    fds.push_back({worker.fd, POLLIN, 0});
+                if (::poll(fds.data(), fds.size(), 20) < 0 && errno != EINTR)
+                    throw std::system_error(errno, std::generic_category(), "can't poll workers");
+                for (std::size_t w = 0; w < workers.size(); w++) {
+                    auto& worker = workers[w];
+                    if (fds[w].revents == 0)
+                        continue;
+                    if (!receive(worker.fd, worker.input)) {
+                        worker_lost(worker);
+                        continue;
+                    }
+                    std::string line;
+                    while (worker.task >= 0 && take_line(worker.input, line)) {
+                        auto task_idx = static_cast<std::size_t>(worker.task);
+                        worker.task = -1;
+                        std::istringstream reply(line);
+                        std::string status;
+                        reply >> status;
+                        if (status != "done") {
+                            failed(task_idx, line.substr(std::min(line.size(), status.size() + 1)));
+                            continue;
+                        }
+                        auto& task = tasks[task_idx];
+                        task.running--;
+                        if (task.done)
+                            continue; // the other attempt was the first
+                        task.done = true;
+                        num_done++;
+                        done_seconds += std::chrono::duration<double>(clock::now() - task.started).count();
+                        parse_reply(task_idx, static_cast<int>(w), reply);
+                    }
+                }
+            }
+
+            // backup attempts which lost are not needed anymore
+            for (auto& worker: workers) {
+                if (worker.task < 0)
+                    continue;
+                auto pid = worker.pid;
+                auto task_command = tasks[static_cast<std::size_t>(worker.task)].command;
+                finish_worker(worker, true);
+                if (task_command.rfind("reduce ", 0) == 0) {
+                    std::error_code ec;
+                    std::filesystem::remove(attempt_output_path(std::stoul(task_command.substr(7)), pid) +
+                                            output_file_extension(output_format), ec);
+                }
+                start_worker(worker);
+            }
+        }
+
+        // main loop of worker process: executes commands until "quit" or end of stream, returns exit code
+        int worker_main(int fd) noexcept {
+            try {
+                std::string buffer;
+                std::string line;
+                while (true) {
+                    while (!take_line(buffer, line)) {
+                        if (!receive(fd, buffer))
+                            return 0;
+                    }
+                    std::istringstream command(line);
+                    std::string kind;
+                    command >> kind;
+                    if (kind == "quit")
+                        return 0;
+                    std::string reply;
+                    try {
+                        if (kind == "map") {
+                            std::size_t task_idx = 0;
+                            std::uint64_t start = 0, end = 0;
+                            command >> task_idx >> start >> end;
+                            reply = run_map_task(task_idx, start, end);
+                        } else if (kind == "reduce") {
+                            std::size_t partition = 0;
+                            command >> partition;
+                            std::vector<std::size_t> runs(num_map_tasks);
+                            for (auto& task_runs: runs)
+                                command >> task_runs;
+                            reply = run_reduce_task(partition, runs);
+                        } else {
+                            reply = "error unknown command " + kind;
+                        }
+                    } catch (const std::exception& ex) {
+                        reply = "error " + std::string(ex.what());
+                        std::replace(reply.begin(), reply.end(), '\n', ' ');
+                    }
+                    send_line(fd, reply);
+                }
+            } catch (...) {
+                return 1;
+            }
+        }
+
+        // maps records of input[start, end) (aligned to lines), writes sorted (and combined) pairs
+        // of each partition to its shuffle file, a run of them each time the memory budget is exceeded
+        std::string run_map_task(std::size_t task_idx, std::uint64_t start, std::uint64_t end) {
+            Stopwatch stopwatch;
+            if (!mapped_file)
+                mapped_file = std::make_unique<MappedFile>(filename);
+            auto data = mapped_file->view();
+            start = align_to_line_start(data, start);
+            end = align_to_line_start(data, end);
+
+            MapTaskStats task_stats;
+            std::vector<std::vector<map_result_t>> buckets(num_partitions);
+            std::size_t buffered_bytes = 0;
+            std::size_t num_runs = 0;
+            auto write_run = [&] {
+                for (std::size_t i = 0; i < buckets.size(); i++) {
+                    sort_by_key<!ReduceTraits<ReduceCls>::order_insensitive>(buckets[i]);
+                    if constexpr (!std::is_same_v<CombineCls, NoCombiner>)
+                        combine_sorted<CombineCls>(buckets[i]);
+                    task_stats.pairs_shuffled += buckets[i].size();
+                    write_shuffle_file(shuffle_file(task_idx, i, num_runs), buckets[i]);
+                    std::vector<map_result_t>().swap(buckets[i]);
+                }
+                num_runs++;
+                buffered_bytes = 0;
+            };
+            MapCls map_func{};
+            PartitionCls partitioner{};
+            auto emit = [&](map_key_t key, map_value_t value) {
+                auto& bucket = buckets[partitioner(key, buckets.size())];
+                bucket.emplace_back(std::move(key), std::move(value));
+                task_stats.pairs_emitted++;
+                if (memory_budget > 0 && (buffered_bytes += approximate_size(bucket.back())) > memory_budget) {
+                    write_run();
+                    task_stats.spilled_runs += buckets.size();
+                }
+            };
+            for_each_record(data, start, end, [&](std::string_view record) {
+                task_stats.records++;
+                task_stats.bytes += record.size();
+                MapTraits<MapCls>::map(map_func, filename, record, emit);
+            });
+            if (num_runs == 0 || buffered_bytes > 0)
+                write_run();
+
+            std::ostringstream reply;
+            reply << "done " << task_stats.records << " " << task_stats.bytes << " " << task_stats.pairs_emitted
+                  << " " << task_stats.pairs_shuffled << " " << stopwatch.wall_seconds() << " "
+                  << stopwatch.cpu_seconds() << " " << task_stats.spilled_runs << " " << num_runs;
+            return reply.str();
+        }
+
+        // merges shuffle files of partition from all runs of map tasks and runs reducer, writes its result
+        std::string run_reduce_task(std::size_t partition, const std::vector<std::size_t>& map_runs) {
+            Stopwatch stopwatch;
+            ReduceTaskStats task_stats;
+            reduce_result_t result{};
+            bool has_result;
+            {
+                std::vector<std::unique_ptr<SortedRun<map_result_t>>> runs;
+                for (std::size_t i = 0; i < num_map_tasks; i++)
+                    for (std::size_t k = 0; k < map_runs[i]; k++)
+                        runs.emplace_back(std::make_unique<ShuffleRun<map_result_t>>(shuffle_file(i, partition, k)));
+                MergedRuns<map_result_t> merged(std::move(runs));
+                auto attempt_path = attempt_output_path(partition, ::getpid());
+                has_result = reduce_sorted_run<ReduceCls>(merged, attempt_path, output_format, result, task_stats);
+                auto extension = output_file_extension(output_format);
+                if (has_result && !extension.empty())
+                    std::filesystem::rename(attempt_path + extension, output_path(partition) + extension);
+            }
+            if (has_result) {
+                std::vector<char> bytes(PortableCodec<reduce_result_t>::max_size(result));
+                auto position = bytes.data();
+                PortableCodec<reduce_result_t>().encode(position, result);
+                auto result_file = work_file("result_" + std::to_string(partition));
+                auto tmp_file = result_file + "." + std::to_string(::getpid()) + ".tmp";
+                {
+                    std::ofstream out(tmp_file, std::ios::binary);
+                    out.write(bytes.data(), position - bytes.data());
+                    out.close();
+                    if (!out)
+                        throw std::runtime_error("can't write " + result_file);
+                }
+                std::filesystem::rename(tmp_file, result_file);
+            }
+
+            std::ostringstream reply;
+            reply << "done " << has_result << " " << task_stats.keys << " " << task_stats.pairs << " "
+                  << stopwatch.wall_seconds() << " " << stopwatch.cpu_seconds() << " "
+                  << task_stats.reduce_call_seconds << " " << task_stats.key_group_histogram.size();
+            for (auto count: task_stats.key_group_histogram)
+                reply << " " << count;
+            return reply.str();
+        }
+    };
+}
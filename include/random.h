@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+namespace mapreduce {
+    // finalizer of splitmix64: mixes all bits of z into all bits of the result
+    inline std::uint64_t mix64(std::uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // splitmix64: small deterministic generator, the same on every platform
+    // (distributions of standard library differ between implementations)
+    class SplitMix64 {
+    public:
+        explicit SplitMix64(std::uint64_t state_) : state(state_) {}
+
+        std::uint64_t next() {
+            return mix64(state += 0x9e3779b97f4a7c15ull);
+        }
+
+        // uniform in [0, 1)
+        double uniform() {
+            return static_cast<double>(next() >> 11) * 0x1.0p-53;
+        }
+
+        // uniform in [0, n)
+        std::uint64_t below(std::uint64_t n) {
+            return static_cast<std::uint64_t>(uniform() * static_cast<double>(n));
+        }
+
+    private:
+        std::uint64_t state;
+    };
+}
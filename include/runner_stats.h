@@ -0,0 +1,188 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <sys/resource.h>
+
+namespace mapreduce {
+    inline double clock_seconds(clockid_t clock_id) {
+        timespec ts{};
+        clock_gettime(clock_id, &ts);
+        return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+    }
+
+    // peak resident set size of the process
+    inline std::uint64_t peak_rss_bytes() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024; // ru_maxrss is in kilobytes on Linux
+    }
+
+    // measures wall and cpu time from construction: cpu time of the process (for phases)
+    // or of the current thread (for tasks)
+    class Stopwatch {
+    public:
+        explicit Stopwatch(clockid_t clock_id_ = CLOCK_PROCESS_CPUTIME_ID) :
+                clock_id(clock_id_),
+                wall_start(std::chrono::steady_clock::now()),
+                cpu_start(clock_seconds(clock_id_)) {}
+
+        double wall_seconds() const {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+        }
+
+        double cpu_seconds() const {
+            return clock_seconds(clock_id) - cpu_start;
+        }
+
+    private:
+        clockid_t clock_id;
+        std::chrono::steady_clock::time_point wall_start;
+        double cpu_start;
+    };
+
+    // histogram[k]: number of values with 2^k <= value < 2^(k+1)
+    inline void add_to_histogram(std::vector<std::uint64_t>& histogram, std::uint64_t value) {
+        std::size_t k = 0;
+        while ((value >> (k + 1)) > 0)
+            k++;
+        if (histogram.size() <= k)
+            histogram.resize(k + 1, 0);
+        histogram[k]++;
+    }
+
+    struct PhaseStats {
+        std::string name;
+        double wall_seconds = 0;
+        double cpu_seconds = 0; // all threads of the process
+    };
+
+    struct MapTaskStats {
+        int worker = -1; // pool worker which ran the task, -1 - thread which called process()
+        double wall_seconds = 0;
+        double cpu_seconds = 0;
+        std::uint64_t records = 0;
+        std::uint64_t bytes = 0;
+        std::uint64_t pairs_emitted = 0;  // returned by map function
+        std::uint64_t pairs_shuffled = 0; // after combiner, passed to shuffle
+        std::uint64_t spilled_runs = 0;
+    };
+
+    struct ReduceTaskStats {
+        int worker = -1;
+        double wall_seconds = 0;
+        double cpu_seconds = 0;
+        double reduce_call_seconds = 0; // inside reduce function (including its output)
+        std::uint64_t keys = 0;
+        std::uint64_t pairs = 0;
+        std::vector<std::uint64_t> key_group_histogram; // number of values of keys, see add_to_histogram
+    };
+
+    // what happened during the last process() call
+    struct RunnerStats {
+        std::vector<PhaseStats> phases;
+        std::vector<MapTaskStats> map_tasks;
+        std::vector<ReduceTaskStats> reduce_tasks;
+        // key_group_histogram[k]: number of keys with 2^k <= number of values < 2^(k+1)
+        std::vector<std::uint64_t> key_group_histogram;
+        std::uint64_t peak_rss_bytes = 0;
+        int unpinned_workers = 0; // workers which should have been pinned to cpus (see ThreadPool::pinning_failures)
+
+        template<typename Field>
+        std::uint64_t total_map(Field field) const {
+            std::uint64_t total = 0;
+            for (const auto& task: map_tasks)
+                total += task.*field;
+            return total;
+        }
+
+        std::uint64_t total_keys() const {
+            std::uint64_t total = 0;
+            for (const auto& task: reduce_tasks)
+                total += task.keys;
+            return total;
+        }
+
+        // human readable report
+        void print(std::ostream& out) const {
+            out << "phases:" << std::endl;
+            for (const auto& phase: phases)
+                out << "  " << phase.name << ": wall " << phase.wall_seconds << " s, cpu " << phase.cpu_seconds
+                    << " s" << std::endl;
+            out << "map: " << total_map(&MapTaskStats::records) << " records, "
+                << total_map(&MapTaskStats::bytes) << " bytes, "
+                << total_map(&MapTaskStats::pairs_emitted) << " pairs emitted, "
+                << total_map(&MapTaskStats::pairs_shuffled) << " pairs shuffled, "
+                << total_map(&MapTaskStats::spilled_runs) << " runs spilled" << std::endl;
+            for (std::size_t i = 0; i < map_tasks.size(); i++) {
+                const auto& task = map_tasks[i];
+                out << "  map task " << i << " (worker " << task.worker << "): wall " << task.wall_seconds
+                    << " s, cpu " << task.cpu_seconds << " s, " << task.records << " records, "
+                    << task.bytes << " bytes, " << task.pairs_emitted << " -> " << task.pairs_shuffled << " pairs"
+                    << std::endl;
+            }
+            out << "reduce: " << total_keys() << " keys" << std::endl;
+            for (std::size_t i = 0; i < reduce_tasks.size(); i++) {
+                const auto& task = reduce_tasks[i];
+                out << "  reduce task " << i << " (worker " << task.worker << "): wall " << task.wall_seconds
+                    << " s, cpu " << task.cpu_seconds << " s, in reduce function " << task.reduce_call_seconds
+                    << " s, " << task.keys << " keys, " << task.pairs << " pairs" << std::endl;
+            }
+            // busy time of each thread over map and reduce tasks
+            std::map<int, std::pair<double, double>> workers;
+            for (const auto& task: map_tasks) {
+                workers[task.worker].first += task.wall_seconds;
+                workers[task.worker].second += task.cpu_seconds;
+            }
+            for (const auto& task: reduce_tasks) {
+                workers[task.worker].first += task.wall_seconds;
+                workers[task.worker].second += task.cpu_seconds;
+            }
+            out << "threads:" << std::endl;
+            for (const auto& [worker, time]: workers)
+                out << "  worker " << worker << ": busy wall " << time.first << " s, cpu " << time.second << " s"
+                    << std::endl;
+            out << "key group sizes:" << std::endl;
+            for (std::size_t k = 0; k < key_group_histogram.size(); k++)
+                if (key_group_histogram[k] > 0)
+                    out << "  [" << (1ull << k) << ", " << (2ull << k) << "): " << key_group_histogram[k]
+                        << std::endl;
+            out << "peak rss: " << peak_rss_bytes << " bytes" << std::endl;
+            out << "unpinned workers: " << unpinned_workers << std::endl;
+        }
+
+        void print_json(std::ostream& out) const {
+            out << "{\"phases\": [";
+            for (std::size_t i = 0; i < phases.size(); i++)
+                out << (i ? ", " : "") << "{\"name\": \"" << phases[i].name << "\", \"wall_seconds\": "
+                    << phases[i].wall_seconds << ", \"cpu_seconds\": " << phases[i].cpu_seconds << "}";
+            out << "], \"map_tasks\": [";
+            for (std::size_t i = 0; i < map_tasks.size(); i++) {
+                const auto& task = map_tasks[i];
+                out << (i ? ", " : "") << "{\"worker\": " << task.worker
+                    << ", \"wall_seconds\": " << task.wall_seconds << ", \"cpu_seconds\": " << task.cpu_seconds
+                    << ", \"records\": " << task.records << ", \"bytes\": " << task.bytes
+                    << ", \"pairs_emitted\": " << task.pairs_emitted << ", \"pairs_shuffled\": " << task.pairs_shuffled
+                    << ", \"spilled_runs\": " << task.spilled_runs << "}";
+            }
+            out << "], \"reduce_tasks\": [";
+            for (std::size_t i = 0; i < reduce_tasks.size(); i++) {
+                const auto& task = reduce_tasks[i];
+                out << (i ? ", " : "") << "{\"worker\": " << task.worker
+                    << ", \"wall_seconds\": " << task.wall_seconds << ", \"cpu_seconds\": " << task.cpu_seconds
+                    << ", \"reduce_call_seconds\": " << task.reduce_call_seconds
+                    << ", \"keys\": " << task.keys << ", \"pairs\": " << task.pairs << "}";
+            }
+            out << "], \"key_group_histogram\": [";
+            for (std::size_t k = 0; k < key_group_histogram.size(); k++)
+                out << (k ? ", " : "") << key_group_histogram[k];
+            out << "], \"peak_rss_bytes\": " << peak_rss_bytes << ", \"unpinned_workers\": " << unpinned_workers << "}"
+                << std::endl;
+        }
+    };
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string>
+#include <iterator>
+#include <cstddef>
+#include "spill.h"
+
+namespace mapreduce {
+    // sorted sequence of pairs which is read one by one
+    template<typename Pair>
+    class SortedRun {
+    public:
+        virtual ~SortedRun() = default;
+
+        // moves next pair to elem, returns false when run is over
+        virtual bool next(Pair& elem) = 0;
+    };
+
+    // run stored in memory, data is moved out while reading
+    template<typename Pair>
+    class VectorRun : public SortedRun<Pair> {
+    public:
+        explicit VectorRun(std::vector<Pair>&& data_) : data(std::move(data_)) {}
+
+        bool next(Pair& elem) override {
+            if (position >= data.size()) {
+                std::vector<Pair>().swap(data); // free memory as soon as run is over
+                return false;
+            }
+            elem = std::move(data[position++]);
+            return true;
+        }
+
+    private:
+        std::vector<Pair> data;
+        std::size_t position = 0;
+    };
+
+    // run packed to contiguous bytes (see packed_pairs.h), pairs are decoded while reading
+    template<typename Pair>
+    class PackedRun : public SortedRun<Pair> {
+    public:
+        explicit PackedRun(std::vector<char>&& bytes_) : bytes(std::move(bytes_)), reader({bytes.data(), bytes.size()}) {}
+
+        bool next(Pair& elem) override {
+            if (!reader.read(elem)) {
+                std::vector<char>().swap(bytes); // free memory as soon as run is over
+                reader = PackedReader<Pair>();
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        std::vector<char> bytes;
+        PackedReader<Pair> reader;
+    };
+
+    // run spilled to disk
+    template<typename Pair>
+    class FileRun : public SortedRun<Pair> {
+    public:
+        explicit FileRun(const std::string& filename) : reader(filename) {}
+
+        bool next(Pair& elem) override {
+            return reader.read(elem);
+        }
+
+    private:
+        RunReader<Pair> reader;
+    };
+
+    // streaming k-way merge of sorted runs by key, holds only one current pair of each run in memory
+    // equal keys keep order of runs (as stable sort of all data)
+    template<typename Pair>
+    class MergedRuns : public SortedRun<Pair> {
+    public:
+        explicit MergedRuns(std::vector<std::unique_ptr<SortedRun<Pair>>>&& runs_) :
+                runs(std::move(runs_)), heads(runs.size()) {
+            for (std::size_t i = 0; i < runs.size(); i++)
+                if (runs[i]->next(heads[i]))
+                    heap.push_back(i);
+            std::make_heap(heap.begin(), heap.end(), Greater{this});
+        }
+
+        bool next(Pair& elem) override {
+            if (heap.empty())
+                return false;
+            std::pop_heap(heap.begin(), heap.end(), Greater{this});
+            auto run_idx = heap.back();
+            elem = std::move(heads[run_idx]);
+            if (runs[run_idx]->next(heads[run_idx]))
+                std::push_heap(heap.begin(), heap.end(), Greater{this});
+            else
+                heap.pop_back();
+            return true;
+        }
+
+    private:
+        std::vector<std::unique_ptr<SortedRun<Pair>>> runs;
+        std::vector<Pair> heads;
+        std::vector<std::size_t> heap;
+
+        // heap of run indices: the smallest current key is on top, ties are resolved by run index
+        struct Greater {
+            const MergedRuns *self;
+
+            bool operator()(std::size_t lhs, std::size_t rhs) const {
+                const auto& lhs_key = self->heads[lhs].first;
+                const auto& rhs_key = self->heads[rhs].first;
+                return rhs_key < lhs_key || (!(lhs_key < rhs_key) && rhs < lhs);
+            }
+        };
+    };
+
+    template<typename Pair>
+    class KeyGroups;
+
+    // single-pass range over values of current key in KeyGroups,
+    // values are read from sorted run while iterating, so the group is never stored in memory
+    template<typename Pair>
+    class GroupValues {
+    public:
+        using value_type = typename Pair::second_type;
+
+        class iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = typename Pair::second_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = value_type *;
+            using reference = value_type&;
+
+            explicit iterator(KeyGroups<Pair> *groups_ = nullptr) : groups(groups_) {}
+
+            reference operator*() const {
+                return groups->current.second;
+            }
+
+            pointer operator->() const {
+                return &groups->current.second;
+            }
+
+            iterator& operator++() {
+                groups->advance();
+                if (!groups->in_group)
+                    groups = nullptr;
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const {
+                return groups == other.groups;
+            }
+
+            bool operator!=(const iterator& other) const {
+                return groups != other.groups;
+            }
+
+        private:
+            KeyGroups<Pair> *groups;
+        };
+
+        explicit GroupValues(KeyGroups<Pair> *groups_) : groups(groups_) {}
+
+        iterator begin() {
+            return iterator(groups->in_group ? groups : nullptr);
+        }
+
+        iterator end() {
+            return iterator();
+        }
+
+    private:
+        KeyGroups<Pair> *groups;
+    };
+
+    // groups sorted run by key:
+    // while (groups.next_key()) reduce(groups.key(), groups.values());
+    template<typename Pair>
+    class KeyGroups {
+    public:
+        using key_type = typename Pair::first_type;
+
+        explicit KeyGroups(SortedRun<Pair>& source_) : source(source_) {
+            has_current = source.next(current);
+        }
+
+        // moves to the next key, values of previous key which were not read are skipped
+        // returns false when there are no more keys
+        bool next_key() {
+            finish_group();
+            if (!has_current)
+                return false;
+            current_key = std::move(current.first);
+            in_group = true;
+            group_size = 1;
+            return true;
+        }
+
+        // skips values of current key which were not read, returns number of values of current key
+        std::size_t finish_group() {
+            while (in_group)
+                advance();
+            return group_size;
+        }
+
+        const key_type& key() const {
+            return current_key;
+        }
+
+        GroupValues<Pair> values() {
+            return GroupValues<Pair>(this);
+        }
+
+    private:
+        friend class GroupValues<Pair>;
+        friend class GroupValues<Pair>::iterator;
+
+        SortedRun<Pair>& source;
+        Pair current;
+        key_type current_key;
+        bool has_current = false;
+        bool in_group = false;
+        std::size_t group_size = 0;
+
+        void advance() {
+            has_current = source.next(current);
+            in_group = has_current && current.first == current_key;
+            if (in_group)
+                group_size++;
+        }
+    };
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <type_traits>
+#include <cstdint>
+#include <cstdlib>
+#include "mapped_file.h"
+#include "packed_pairs.h"
+
+namespace mapreduce {
+    // approximate number of bytes used by value in memory (used to check memory budget of mappers)
+    template<typename T>
+    std::size_t approximate_size(const T& value) {
+        if constexpr (std::is_same_v<T, std::string>)
+            return sizeof(T) + (value.capacity() > std::string().capacity() ? value.capacity() : 0);
+        else
+            return sizeof(T);
+    }
+
+    template<typename First, typename Second>
+    std::size_t approximate_size(const std::pair<First, Second>& value) {
+        return approximate_size(value.first) + approximate_size(value.second) +
+               sizeof(value) - sizeof(First) - sizeof(Second);
+    }
+
+    // writes sorted pairs to run file in packed format (see packed_pairs.h)
+    template<typename Pair>
+    class RunWriter {
+    public:
+        explicit RunWriter(const std::string& filename_) : filename(filename_), out(filename_, std::ios::binary) {
+            if (!out)
+                throw std::runtime_error("can't create run file " + filename);
+            buffer.reserve(buffer_size);
+        }
+
+        void write(const Pair& elem) {
+            writer.write(buffer, elem);
+            if (buffer.size() >= buffer_size)
+                flush();
+        }
+
+        void close() {
+            flush();
+            out.close();
+            if (!out)
+                throw std::runtime_error("can't write run file " + filename);
+        }
+
+    private:
+        static constexpr std::size_t buffer_size = 1 << 20;
+        std::string filename;
+        std::ofstream out;
+        std::vector<char> buffer;
+        PackedWriter<Pair> writer;
+
+        void flush() {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    };
+
+    // reads pairs from memory mapped run file one by one
+    template<typename Pair>
+    class RunReader {
+    public:
+        explicit RunReader(const std::string& filename) : file(filename), reader(file.view()) {}
+
+        bool read(Pair& elem) {
+            return reader.read(elem);
+        }
+
+    private:
+        MappedFile file;
+        PackedReader<Pair> reader;
+    };
+
+    // unique temporary directory for run files, removed with all its content in destructor
+    class TempDirectory {
+    public:
+        explicit TempDirectory(const std::string& base_path = "") {
+            auto base = base_path.empty() ? std::filesystem::temp_directory_path() : std::filesystem::path(base_path);
+            std::string path_template = (base / "yamr-XXXXXX").string();
+            if (::mkdtemp(&path_template[0]) == nullptr)
+                throw std::runtime_error("can't create temporary directory in " + base.string());
+            path = path_template;
+        }
+
+        TempDirectory(const TempDirectory&) = delete;
+        TempDirectory& operator=(const TempDirectory&) = delete;
+
+        ~TempDirectory() {
+            std::error_code ec; // destructor must not throw
+            std::filesystem::remove_all(path, ec);
+        }
+
+        std::string file(const std::string& name) const {
+            return (path / name).string();
+        }
+
+    private:
+        std::filesystem::path path;
+    };
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+namespace mapreduce {
+    // append-only storage for strings: strings are copied to big blocks,
+    // so storing a string costs one allocation per block instead of one per string
+    // returned views are valid until clear() or destruction of the arena
+    class StringArena {
+    public:
+        explicit StringArena(std::size_t block_size_ = 1 << 20) : block_size(block_size_) {}
+
+        std::string_view store(std::string_view value) {
+            if (value.size() > space_left) {
+                // big strings get their own block, so the rest of the current block is not wasted
+                auto size = std::max(block_size, value.size());
+                blocks.emplace_back(new char[size]);
+                if (size == block_size) {
+                    current = blocks.back().get();
+                    space_left = size;
+                } else {
+                    std::memcpy(blocks.back().get(), value.data(), value.size());
+                    bytes_used += value.size();
+                    return {blocks.back().get(), value.size()};
+                }
+            }
+            std::memcpy(current, value.data(), value.size());
+            std::string_view result(current, value.size());
+            current += value.size();
+            space_left -= value.size();
+            bytes_used += value.size();
+            return result;
+        }
+
+        std::size_t size() const {
+            return bytes_used;
+        }
+
+        void clear() {
+            blocks.clear();
+            current = nullptr;
+            space_left = 0;
+            bytes_used = 0;
+        }
+
+    private:
+        std::size_t block_size;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char *current = nullptr;
+        std::size_t space_left = 0;
+        std::size_t bytes_used = 0;
+    };
+}
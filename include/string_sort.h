@@ -0,0 +1,135 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+#include "thread_pool.h"
+
+namespace mapreduce {
+    // stable MSD radix sort of values by string keys:
+    // - each level distributes a range by the byte at current depth (strings which end go first),
+    //   bytes are read once per level into a separate array, so counting and moving don't touch strings again
+    // - ranges with equal byte are sorted on the next level, small ranges are sorted by insertion
+    // - big ranges are sorted in parallel on thread pool (nested tasks are fine, see ThreadPool::parallel_for)
+    // compares each byte of keys O(1) times instead of O(log n) times in comparison sorts
+    template<typename T, typename KeyOf>
+    class StringRadixSort {
+    public:
+        StringRadixSort(std::vector<T>& values_, KeyOf key_of_, ThreadPool *thread_pool_) :
+                values(values_), key_of(std::move(key_of_)), thread_pool(thread_pool_) {}
+
+        void operator()() {
+            if (values.size() < 2)
+                return;
+            buffer.resize(values.size());
+            symbols.resize(values.size());
+            sort(0, values.size(), 0);
+            std::vector<T>().swap(buffer);
+        }
+
+    private:
+        static constexpr std::size_t insertion_sort_size = 32;
+        static constexpr std::size_t parallel_size = 1 << 15;
+
+        std::vector<T>& values;
+        KeyOf key_of;
+        ThreadPool *thread_pool;
+        std::vector<T> buffer;                // for moving values of range, then they are moved back
+        std::vector<std::uint16_t> symbols;   // symbols[i]: 0 if key of values[i] is shorter than depth, byte + 1
+
+        std::string_view key(std::size_t idx) const {
+            return key_of(values[idx]);
+        }
+
+        // sorts values[begin, end), all keys in range have equal first depth bytes
+        void sort(std::size_t begin, std::size_t end, std::size_t depth) {
+            while (end - begin >= insertion_sort_size) {
+                std::array<std::size_t, 257> counts{};
+                for (std::size_t i = begin; i < end; i++) {
+                    auto current = key(i);
+                    symbols[i] = depth < current.size() ? static_cast<std::uint16_t>(
+                            static_cast<unsigned char>(current[depth]) + 1) : 0;
+                    counts[symbols[i]]++;
+                }
+
+                if (counts[symbols[begin]] == end - begin) {
+                    if (symbols[begin] == 0)
+                        return; // all keys are equal
+                    depth++; // all keys have the same byte: nothing to move
+                    continue;
+                }
+
+                std::array<std::size_t, 257> positions{};
+                for (std::size_t s = 1; s < counts.size(); s++)
+                    positions[s] = positions[s - 1] + counts[s - 1];
+                for (std::size_t i = begin; i < end; i++)
+                    buffer[begin + positions[symbols[i]]++] = std::move(values[i]);
+                std::move(buffer.begin() + begin, buffer.begin() + end, values.begin() + begin);
+
+                // keys which end at depth (symbol 0) are equal, other ranges are sorted by the next byte
+                std::vector<std::pair<std::size_t, std::size_t>> ranges;
+                auto range_begin = begin + counts[0];
+                for (std::size_t s = 1; s < counts.size(); range_begin += counts[s], s++)
+                    if (counts[s] > 1)
+                        ranges.emplace_back(range_begin, range_begin + counts[s]);
+
+                if (thread_pool != nullptr && end - begin >= parallel_size && ranges.size() > 1) {
+                    thread_pool->parallel_for(ranges.size(), [this, &ranges, depth](std::size_t k) {
+                        this->sort(ranges[k].first, ranges[k].second, depth + 1);
+                    });
+                } else {
+                    for (const auto& range: ranges)
+                        sort(range.first, range.second, depth + 1);
+                }
+                return;
+            }
+            insertion_sort(begin, end, depth);
+        }
+
+        void insertion_sort(std::size_t begin, std::size_t end, std::size_t depth) {
+            for (std::size_t i = begin + 1; i < end; i++) {
+                if (!(key(i).substr(depth) < key(i - 1).substr(depth)))
+                    continue;
+                T current = std::move(values[i]);
+                auto current_key = key_of(current).substr(depth);
+                auto j = i;
+                for (; j > begin && current_key < key(j - 1).substr(depth); j--)
+                    values[j] = std::move(values[j - 1]);
+                values[j] = std::move(current);
+            }
+        }
+    };
+
+    // sorts values by string keys (stable), key_of(value) must return something convertible to std::string_view
+    // which stays valid while values are moved; big ranges are sorted in parallel by thread_pool
+    // (pool of the current worker by default: nullptr outside of pool tasks)
+    template<typename T, typename KeyOf>
+    void string_sort(std::vector<T>& values, KeyOf key_of, ThreadPool *thread_pool = ThreadPool::current()) {
+        auto view_of = [&key_of](const T& value) { return std::string_view(key_of(value)); };
+        StringRadixSort<T, decltype(view_of)>(values, view_of, thread_pool)();
+    }
+
+    // sorts strings (std::string, std::string_view)
+    template<typename T>
+    void string_sort(std::vector<T>& values) {
+        string_sort(values, [](const T& value) -> const T& { return value; });
+    }
+
+    // sorts pairs by key: radix sort for string keys (always stable), comparison sort for others
+    // (stable unless order of equal keys doesn't matter)
+    template<bool stable = true, typename Pair>
+    void sort_by_key(std::vector<Pair>& pairs) {
+        using key_t = typename Pair::first_type;
+        auto less = [](const Pair& lhs, const Pair& rhs) { return lhs.first < rhs.first; };
+        if constexpr (std::is_convertible_v<const key_t&, std::string_view>)
+            string_sort(pairs, [](const Pair& pair) -> const key_t& { return pair.first; });
+        else if constexpr (stable)
+            std::stable_sort(pairs.begin(), pairs.end(), less);
+        else
+            std::sort(pairs.begin(), pairs.end(), less);
+    }
+}
@@ -0,0 +1,247 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <cstddef>
+#include <chrono>
+#include <utility>
+#include "cpu_affinity.h"
+
+namespace mapreduce {
+    class TaskGroup;
+
+    // persistent pool of worker threads with work stealing:
+    // each worker has its own deque of tasks, takes tasks from its back
+    // and steals from the front of other deques when it has nothing to do
+    // threads are created once and reused by all phases and by repeated runs
+    // with pin_to_cpus each worker is bound to its own cpu (see cpus_by_node), so it keeps its caches,
+    // and memory it allocates and touches first stays on its NUMA node; workers are pinned before
+    // the constructor returns, those which couldn't be pinned are counted (see pinning_failures)
+    class ThreadPool {
+    public:
+        using Task = std::function<void()>;
+
+        explicit ThreadPool(int num_workers, bool pin_to_cpus = false) :
+                queues(static_cast<std::size_t>(std::max(num_workers, 1))) {
+            if (pin_to_cpus)
+                worker_cpus = cpus_by_node();
+            for (auto& queue: queues)
+                queue = std::make_unique<WorkerQueue>();
+            for (std::size_t i = 0; i < queues.size(); i++)
+                workers.emplace_back([this, i] { this->worker_loop(i); });
+            if (pin_to_cpus)
+                for (std::size_t i = 0; i < workers.size(); i++)
+                    if (worker_cpus.empty() || !pin_thread(workers[i].native_handle(), worker_cpu(static_cast<int>(i))))
+                        num_pinning_failures++;
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(sleep_mutex);
+                stopped = true;
+            }
+            wake_up.notify_all();
+            for (auto& worker: workers)
+                worker.join();
+        }
+
+        int size() const {
+            return static_cast<int>(workers.size());
+        }
+
+        // index of worker running in the current thread, -1 if the current thread is not a worker of this pool
+        int worker_index() const {
+            return current_worker_idx();
+        }
+
+        // cpu which worker is pinned to, -1 if workers are not pinned
+        // (when there are more workers than cpus, cpus are reused round-robin)
+        int worker_cpu(int idx) const {
+            return worker_cpus.empty() ? -1 : worker_cpus[static_cast<std::size_t>(idx) % worker_cpus.size()];
+        }
+
+        // number of workers which should have been pinned to cpus, but run on any allowed cpu
+        // (affinity of the process is unknown, or setting affinity of the worker failed)
+        int pinning_failures() const {
+            return num_pinning_failures;
+        }
+
+        // pool of the worker running in the current thread, nullptr for other threads
+        // (lets code called from tasks, e.g. map and reduce functions, split its work further)
+        static ThreadPool *current() {
+            return worker_pool;
+        }
+
+        // tasks from a worker of this pool go to its own deque (they are likely to use hot data),
+        // tasks from other threads are distributed between workers round-robin
+        void submit(Task task) {
+            auto idx = current_worker_idx();
+            if (idx < 0)
+                idx = static_cast<int>(next_queue++ % queues.size());
+            {
+                std::lock_guard<std::mutex> lock(queues[idx]->mutex);
+                queues[idx]->tasks.push_back(std::move(task));
+                std::lock_guard<std::mutex> sleep_lock(sleep_mutex); // same lock order as in take_task
+                num_queued++;
+            }
+            wake_up.notify_one();
+        }
+
+        // runs one queued task in the calling thread, returns false if there is nothing to run
+        bool run_pending_task() {
+            auto idx = current_worker_idx();
+            Task task;
+            if (!take_task(idx < 0 ? 0 : static_cast<std::size_t>(idx), task))
+                return false;
+            task();
+            return true;
+        }
+
+        // calls func(i) for i in [0, num_tasks) as separate tasks and waits for all of them
+        // (waiting thread executes tasks too, so parallel_for can be called from tasks)
+        // the first exception thrown by a task is rethrown
+        template<typename Func>
+        void parallel_for(std::size_t num_tasks, Func func);
+
+    private:
+        struct WorkerQueue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<WorkerQueue>> queues;
+        std::vector<std::thread> workers;
+        std::vector<int> worker_cpus;
+        int num_pinning_failures = 0;
+        std::atomic<std::size_t> next_queue{0};
+
+        std::mutex sleep_mutex;
+        std::condition_variable wake_up;
+        std::size_t num_queued = 0;
+        bool stopped = false;
+
+        // pool and index of the worker running in the current thread
+        static inline thread_local ThreadPool *worker_pool = nullptr;
+        static inline thread_local int worker_idx = -1;
+
+        // index of the current thread in this pool, -1 for other threads
+        int current_worker_idx() const {
+            return worker_pool == this ? worker_idx : -1;
+        }
+
+        // own tasks are taken from the back (LIFO), stolen tasks from the front (FIFO)
+        bool take_task(std::size_t own_idx, Task& task) {
+            for (std::size_t k = 0; k < queues.size(); k++) {
+                auto& queue = *queues[(own_idx + k) % queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty())
+                    continue;
+                if (k == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                std::lock_guard<std::mutex> sleep_lock(sleep_mutex);
+                num_queued--;
+                return true;
+            }
+            return false;
+        }
+
+        void worker_loop(std::size_t idx) {
+            worker_pool = this;
+            worker_idx = static_cast<int>(idx);
+            while (true) {
+                Task task;
+                if (take_task(idx, task)) {
+                    task();
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                wake_up.wait(lock, [this] { return stopped || num_queued > 0; });
+                if (stopped && num_queued == 0)
+                    return;
+            }
+        }
+    };
+
+    // tasks of a pool which are waited for together: tasks can add new tasks to their group while running,
+    // so a task can start the tasks which depend on it (e.g. pipelined map, merge and reduce)
+    // wait() runs tasks in the calling thread too and rethrows the first exception thrown by a task
+    class TaskGroup {
+    public:
+        explicit TaskGroup(ThreadPool& pool_) : pool(pool_) {}
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        // tasks refer to the group: it can't be destroyed before they are done
+        ~TaskGroup() {
+            wait_for_tasks();
+        }
+
+        template<typename Func>
+        void run(Func func) {
+            remaining++;
+            pool.submit([this, func = std::move(func)]() mutable {
+                try {
+                    func();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!error)
+                        error = std::current_exception();
+                }
+                // counter is changed under lock: waiting thread can't return and destroy mutex
+                // and condition variable between the last decrement and notification
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--remaining == 0)
+                    all_done.notify_all();
+            });
+        }
+
+        void wait() {
+            wait_for_tasks();
+            if (error)
+                std::rethrow_exception(std::exchange(error, nullptr));
+        }
+
+    private:
+        ThreadPool& pool;
+        std::atomic<std::size_t> remaining{0};
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable all_done;
+
+        void wait_for_tasks() {
+            while (remaining > 0) {
+                if (pool.run_pending_task())
+                    continue;
+                // all tasks are taken: sleep until they are done, but wake up sometimes to help with nested tasks
+                std::unique_lock<std::mutex> lock(mutex);
+                all_done.wait_for(lock, std::chrono::milliseconds(1), [&] { return remaining == 0; });
+            }
+            std::lock_guard<std::mutex> lock(mutex); // the last task has released the lock
+        }
+    };
+
+    template<typename Func>
+    void ThreadPool::parallel_for(std::size_t num_tasks, Func func) {
+        TaskGroup tasks(*this);
+        for (std::size_t i = 0; i < num_tasks; i++)
+            tasks.run([&func, i] { func(i); });
+        tasks.wait();
+    }
+}
@@ -3,23 +3,138 @@
 #include <fstream>
 #include <string>
 #include <algorithm>
+#include <vector>
 #include "map_reduce_runner.h"
 #include "prefix_functors.h"
+#include "prefix_trie.h"
+#include "prefix_incremental.h"
+#include "prefix_approximate.h"
+#include "process_runner.h"
+#include "spill.h"
 
 bool file_exists(const std::string& filename) {
     std::ifstream infile(filename);
     return infile.good();
 }
 
+// runners need a file (it is mapped and split between mappers), so stdin is copied to temporary file
+std::string save_stdin(const mapreduce::TempDirectory& directory) {
+    auto filename = directory.file("stdin.txt");
+    std::ofstream out(filename, std::ios::binary);
+    out << std::cin.rdbuf();
+    return filename;
+}
+
+// runs task and prints its statistics to stderr if needed
+template<typename Runner>
+std::vector<int> run_and_report(Runner&& runner, const std::string& stats_format) {
+    auto results = runner.process();
+    if (runner.stats().unpinned_workers > 0)
+        std::cerr << "Warning: " << runner.stats().unpinned_workers << " worker threads are not pinned to cpus"
+                  << std::endl;
+    if (stats_format == "json")
+        runner.stats().print_json(std::cerr);
+    else if (!stats_format.empty())
+        runner.stats().print(std::cerr);
+    return results;
+}
+
+struct RunOptions {
+    std::string src_file;
+    int num_threads_map = 1;
+    int num_threads_reduce = 1;
+    mapreduce::OutputFormat output_format = mapreduce::OutputFormat::text;
+    std::string stats_format; // empty - no statistics
+    bool processes = false;   // map and reduce tasks in worker processes instead of threads
+    bool pipelined = false;   // no barriers between map, shuffle and reduce
+    bool pin_threads = false; // workers pinned to cpus, node by node
+};
+
+template<typename MapCls, typename ReduceCls,
+        typename PartitionCls = mapreduce::HashPartitioner,
+        typename CombineCls = mapreduce::NoCombiner>
+std::vector<int> run_map_reduce(const RunOptions& options) {
+    if (options.processes) {
+        mapreduce::ProcessRunner<MapCls, ReduceCls, PartitionCls, CombineCls> runner(
+                options.src_file, options.num_threads_map, options.num_threads_reduce);
+        runner.set_output_format(options.output_format);
+        return run_and_report(runner, options.stats_format);
+    }
+    mapreduce::MapReduceRunner<MapCls, ReduceCls, PartitionCls, CombineCls> runner(
+            options.src_file, options.num_threads_map, options.num_threads_reduce);
+    runner.set_output_format(options.output_format);
+    runner.set_pipelined(options.pipelined);
+    runner.set_pin_threads(options.pin_threads);
+    return run_and_report(runner, options.stats_format);
+}
+
+// engines selected with --algorithm: all of them are instantiated at compile time, one is chosen by name
+struct Engine {
+    std::string name;
+    std::string description;
+    std::vector<int> (*run)(const RunOptions& options);
+    bool processes = true; // can run in worker processes
+    bool pipelined = true;  // has pipelined mode
+    bool output = true;     // writes reduce_N files in format of --output
+};
+
+const std::vector<Engine> engines{
+        // first letter as key: no memory overhead, very fast, handles correctly duplicated emails
+        {"optimized",     "first letter as key, reducers sort emails (default)",
+                run_map_reduce<prefix_optimized::PrefixMapper, prefix_optimized::PrefixReducer>},
+        // original algorithm with prefixes generation, works correctly when there are duplicated emails
+        {"prefix",        "all prefixes as keys, emails as values",
+                run_map_reduce<prefix::PrefixMapper, prefix::PrefixReducer>},
+        // original algorithm with prefixes generation, works correctly when there are NO duplicated emails
+        {"no_duplicates", "all prefixes as keys, counts as values (emails must be distinct)",
+                run_map_reduce<prefix_no_duplicates::PrefixMapper, prefix_no_duplicates::PrefixReducer,
+                        mapreduce::HashPartitioner, prefix_no_duplicates::PrefixCombiner>},
+        // radix tries built by mappers and merged in parallel, no sorting, no output files
+        {"trie",          "radix tries merged in parallel, no output files",
+                [](const RunOptions& options) {
+                    prefix_trie::ShortestPrefixEngine engine(
+                            options.src_file, options.num_threads_map, options.num_threads_reduce);
+                    engine.set_pin_threads(options.pin_threads);
+                    return run_and_report(engine, options.stats_format);
+                }, false, false, false},
+        // sample and bloom filter check of candidate lengths: upper bound of the answer, bounds go to stderr
+        {"approximate",   "estimate from sample and bloom filters (upper bound, bounds to stderr)",
+                [](const RunOptions& options) {
+                    prefix_approximate::ApproximatePrefixEngine engine(
+                            options.src_file, options.num_threads_map, options.num_threads_reduce);
+                    engine.set_pin_threads(options.pin_threads);
+                    auto results = run_and_report(engine, options.stats_format);
+                    const auto& bounds = engine.bounds();
+                    if (!results.empty())
+                        std::cerr << "answer is in [" << bounds.lower << ", " << bounds.upper
+                                  << "] with probability >= " << bounds.confidence << std::endl;
+                    return results;
+                }, false, false, false},
+};
+
+const Engine *find_engine(const std::string& name) {
+    auto engine = std::find_if(engines.cbegin(), engines.cend(), [&](const Engine& e) { return e.name == name; });
+    return engine == engines.cend() ? nullptr : &*engine;
+}
+
 int main(int argc, char *argv[]) {
     bool executed_correctly = true;
     std::stringstream whats_wrong;
     std::string src_file;
     int num_threads_map = 1;
     int num_threads_reduce = 1;
+    std::string algorithm = "optimized";
+    std::string stats_format; // empty - no statistics
+    std::string state_directory; // not empty - incremental mode
+    bool processes = false;
+    bool pipelined = false;
+    bool pin_threads = false;
+    auto output_format = mapreduce::OutputFormat::text;
+    bool algorithm_given = false; // incremental mode has its own algorithm and no output files
+    bool output_given = false;
 
 
-    if (argc != 4) {
+    if (argc < 4) {
         executed_correctly = false;
         whats_wrong << "Incorrect number of arguments";
     } else {
@@ -30,10 +145,73 @@ int main(int argc, char *argv[]) {
             if (num_threads_map <= 0 or num_threads_reduce <= 0) {
                 whats_wrong << "Number of threads must be positive";
                 executed_correctly = false;
-            } else if (!file_exists(src_file)) {
+            } else if (src_file != "-" && !file_exists(src_file)) {
                 whats_wrong << "File " << src_file << " doesn't exist!";
                 executed_correctly = false;
             }
+            for (int i = 4; i < argc && executed_correctly; i++) {
+                std::string option = argv[i];
+                if (option == "--algorithm" && i + 1 < argc) {
+                    algorithm = argv[++i];
+                    algorithm_given = true;
+                    if (find_engine(algorithm) == nullptr) {
+                        whats_wrong << "Unknown algorithm " << algorithm;
+                        executed_correctly = false;
+                    }
+                } else if (option == "--stats" || option == "--stats=human") {
+                    stats_format = "human";
+                } else if (option == "--output" && i + 1 < argc) {
+                    std::string format = argv[++i];
+                    output_given = true;
+                    if (format == "text") {
+                        output_format = mapreduce::OutputFormat::text;
+                    } else if (format == "gzip" && mapreduce::output_format_supported(mapreduce::OutputFormat::gzip)) {
+                        output_format = mapreduce::OutputFormat::gzip;
+                    } else if (format == "none") {
+                        output_format = mapreduce::OutputFormat::none;
+                    } else {
+                        whats_wrong << "Unsupported output format " << format;
+                        executed_correctly = false;
+                    }
+                } else if (option == "--incremental" && i + 1 < argc) {
+                    state_directory = argv[++i];
+                } else if (option == "--stats=json") {
+                    stats_format = "json";
+                } else if (option == "--processes") {
+                    processes = true;
+                } else if (option == "--pipelined") {
+                    pipelined = true;
+                } else if (option == "--pin-threads") {
+                    pin_threads = true;
+                } else {
+                    whats_wrong << "Unknown option " << option;
+                    executed_correctly = false;
+                }
+            }
+            if (executed_correctly && !state_directory.empty() && (algorithm_given || output_given)) {
+                whats_wrong << (algorithm_given ? "--algorithm" : "--output")
+                            << " is not supported by incremental mode";
+                executed_correctly = false;
+            }
+            if (executed_correctly && output_given && state_directory.empty() && !find_engine(algorithm)->output) {
+                whats_wrong << "--output is not supported by " << algorithm;
+                executed_correctly = false;
+            }
+            if (executed_correctly && processes && (!state_directory.empty() || !find_engine(algorithm)->processes)) {
+                whats_wrong << "--processes is not supported by " << (state_directory.empty() ? algorithm
+                                                                                               : "incremental mode");
+                executed_correctly = false;
+            }
+            if (executed_correctly && pipelined &&
+                (!state_directory.empty() || processes || !find_engine(algorithm)->pipelined)) {
+                whats_wrong << "--pipelined is not supported by " << (!state_directory.empty() ? "incremental mode" :
+                                                                      processes ? "--processes" : algorithm);
+                executed_correctly = false;
+            }
+            if (executed_correctly && pin_threads && processes) {
+                whats_wrong << "--pin-threads is not supported by --processes";
+                executed_correctly = false;
+            }
         } catch (std::exception& ex) {
             executed_correctly = false;
             whats_wrong << ex.what();
@@ -45,22 +223,54 @@ int main(int argc, char *argv[]) {
         std::cout << "Execute with 3 arguments - source file, num threads for map, num threads for reduce, e.g.:"
                   << std::endl;
         std::cout << argv[0] << " infile.txt 4 4" << std::endl;
+        std::cout << "Source file \"-\" reads emails from stdin" << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "  --algorithm NAME    one of:" << std::endl;
+        for (const auto& engine: engines)
+            std::cout << "                      " << engine.name << " - " << engine.description << std::endl;
+        std::cout << "  --output FORMAT     reduce_N.txt files: text (default), gzip (reduce_N.txt.gz) or none"
+                  << std::endl;
+        std::cout << "  --incremental DIR   keep sorted emails in DIR between runs and add only new ones:"
+                  << std::endl
+                  << "                      appended part of source file or all emails from stdin"
+                  << std::endl << "                      (without --algorithm and --output)" << std::endl;
+        std::cout << "  --processes         run map and reduce tasks in worker processes (numbers of threads are"
+                  << std::endl
+                  << "                      numbers of processes): a crashed task is executed again" << std::endl;
+        std::cout << "  --pipelined         merge sorted runs while mappers are running and start each reducer"
+                  << std::endl
+                  << "                      as soon as its runs are ready, without barriers between phases"
+                  << std::endl;
+        std::cout << "  --pin-threads       pin worker threads to cpus, filling one NUMA node before the next one"
+                  << std::endl;
+        std::cout << "  --stats[=json]      print time, data sizes and memory of phases and tasks to stderr"
+                  << std::endl;
         exit(0);
     }
 
-    // original algorithm with prefixes generation, works correctly when there are NO duplicated emails
-//    using namespace prefix_no_duplicates;
-
-// original algorithm with prefixes generation, works correctly when there are duplicated emails
-//    using namespace prefix;
-
-    // optimized algorithm with first letter as key: no memory overhead, very fast, handles correctly duplicated emails
-    using namespace prefix_optimized;
-
-    auto task_runner = mapreduce::MapReduceRunner<PrefixMapper, PrefixReducer>(
-            src_file, num_threads_map, num_threads_reduce
-    );
-    std::vector<int> reduce_results = task_runner.process();
+    // errors of the run itself (e.g. input shorter than its processed part, broken state of incremental mode,
+    // failed output) are reported like errors of arguments, but with non-zero exit code
+    std::vector<int> reduce_results;
+    try {
+        if (!state_directory.empty()) {
+            prefix_incremental::IncrementalPrefixEngine engine(
+                    src_file, state_directory, std::max(num_threads_map, num_threads_reduce));
+            engine.set_pin_threads(pin_threads);
+            reduce_results = run_and_report(engine, stats_format);
+        } else if (src_file == "-") {
+            mapreduce::TempDirectory stdin_directory;
+            reduce_results = find_engine(algorithm)->run(
+                    {save_stdin(stdin_directory), num_threads_map, num_threads_reduce, output_format, stats_format,
+                     processes, pipelined, pin_threads});
+        } else {
+            reduce_results = find_engine(algorithm)->run(
+                    {src_file, num_threads_map, num_threads_reduce, output_format, stats_format, processes,
+                     pipelined, pin_threads});
+        }
+    } catch (const std::exception& ex) {
+        std::cout << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
     auto result = std::max_element(reduce_results.cbegin(), reduce_results.cend());
     if (result != reduce_results.cend()) {
         std::cout << *result << std::endl;
@@ -4,9 +4,21 @@
 #include <sstream>
 #include <string>
 #include <algorithm>
+#include <thread>
+#include <functional>
+#include <csignal>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "project_path.h"
 #include "map_reduce_runner.h"
 #include "prefix_functors.h"
+#include "prefix_trie.h"
+#include "prefix_incremental.h"
+#include "prefix_approximate.h"
+#include "email_generator.h"
+#include "lcp.h"
+#include "string_sort.h"
+#include "process_runner.h"
 
 using namespace std::string_literals;
 
@@ -20,6 +32,26 @@ struct TestParams {
 class AssignmentTestFromFile : public testing::TestWithParam<TestParams> {
 };
 
+using prefix_runner_t = mapreduce::MapReduceRunner<prefix::PrefixMapper, prefix::PrefixReducer>;
+using combiner_runner_t = mapreduce::MapReduceRunner<prefix_no_duplicates::PrefixMapper,
+        prefix_no_duplicates::PrefixReducer, mapreduce::HashPartitioner, prefix_no_duplicates::PrefixCombiner>;
+
+// answer of runner for test parameters, configure(runner) is called before process()
+template<typename Runner, typename Configure>
+int run_assignment(const TestParams& params, Configure configure,
+                   mapreduce::InputMode input_mode = mapreduce::InputMode::mmap) {
+    Runner task_runner(params.in_file, params.num_threads_map, params.num_threads_reduce, "", input_mode);
+    configure(task_runner);
+    std::vector<int> reduce_results = task_runner.process();
+    auto result = std::max_element(reduce_results.cbegin(), reduce_results.cend());
+    return result == reduce_results.cend() ? -1 : *result;
+}
+
+template<typename Runner>
+int run_assignment(const TestParams& params) {
+    return run_assignment<Runner>(params, [](Runner&) {});
+}
+
 TEST_P(AssignmentTestFromFile, AssignmentExample) {
     auto task_runner = mapreduce::MapReduceRunner<
             prefix::PrefixMapper,
@@ -44,6 +76,694 @@ TEST_P(AssignmentTestFromFile, AssignmentExampleOptimized) {
     ASSERT_EQ(*result, GetParam().expected_result);
 }
 
+TEST_P(AssignmentTestFromFile, AssignmentExampleTrie) {
+    auto engine = prefix_trie::ShortestPrefixEngine(
+            GetParam().in_file,
+            GetParam().num_threads_map,
+            GetParam().num_threads_reduce);
+    std::vector<int> results = engine.process();
+    auto result = std::max_element(results.cbegin(), results.cend());
+    ASSERT_EQ(*result, GetParam().expected_result);
+}
+
+TEST_P(AssignmentTestFromFile, AssignmentExampleApproximate) {
+    // sample is bigger than test files: lower bound is exact, and upper bound is verified
+    auto engine = prefix_approximate::ApproximatePrefixEngine(
+            GetParam().in_file,
+            GetParam().num_threads_map,
+            GetParam().num_threads_reduce);
+    std::vector<int> results = engine.process();
+    ASSERT_EQ(results, std::vector<int>{GetParam().expected_result});
+    ASSERT_EQ(engine.bounds().lower, GetParam().expected_result);
+}
+
+TEST(ApproximatePrefix, BoundsContainAnswer) {
+    mapreduce::TempDirectory directory;
+    auto input = directory.file("emails.txt");
+    synthetic::EmailGeneratorOptions options;
+    options.count = 20000;
+    options.shared_prefix_depth = 4;
+    options.duplicate_ratio = 0.2;
+    {
+        std::ofstream out(input);
+        synthetic::EmailGenerator(options).write(out);
+    }
+    auto exact = prefix_trie::ShortestPrefixEngine(input, 2, 2).process();
+    for (std::size_t sample_size: {10, 300, 100000}) {
+        prefix_approximate::ApproximatePrefixEngine engine(input, 3, 2);
+        engine.set_sample_size(sample_size);
+        auto results = engine.process();
+        const auto& bounds = engine.bounds();
+        ASSERT_LE(bounds.lower, exact[0]);
+        ASSERT_GE(bounds.upper, exact[0]);
+        ASSERT_EQ(results, std::vector<int>{bounds.upper});
+        ASSERT_GT(bounds.confidence, 0.99);
+        // reduce tasks of check, then of verify when it ran
+        const auto& stats = engine.stats();
+        bool verified = std::any_of(stats.phases.cbegin(), stats.phases.cend(),
+                                    [](const auto& phase) { return phase.name == "verify"; });
+        ASSERT_EQ(stats.reduce_tasks.size(), verified ? 4 : 2);
+    }
+}
+
+TEST(RadixTrie, ShortestUniquePrefix) {
+    prefix_trie::RadixTrie trie;
+    trie.insert("abcd");
+    ASSERT_EQ(trie.shortest_unique_prefix(), 1);
+    trie.insert("abcd");
+    ASSERT_EQ(trie.shortest_unique_prefix(), 1);
+    trie.insert("abxy");
+    ASSERT_EQ(trie.shortest_unique_prefix(), 3);
+    trie.insert("ab");
+    ASSERT_EQ(trie.shortest_unique_prefix(), 3);
+
+    prefix_trie::RadixTrie other;
+    other.insert("abcde");
+    trie.merge(other);
+    ASSERT_EQ(trie.shortest_unique_prefix(), 5);
+}
+
+TEST(RadixTrie, MergedTriesMatchOneTrie) {
+    // short words of two letters: labels of both tries split at many different depths
+    std::vector<std::string> words;
+    std::uint64_t state = 7;
+    for (int i = 0; i < 2000; i++) {
+        std::string word;
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        for (auto length = 1 + (state >> 60); length > 0; length--)
+            word += static_cast<char>('a' + ((state >> (20 + length)) & 1));
+        words.push_back(word);
+    }
+    for (std::size_t parts: {2, 3, 7}) {
+        std::vector<prefix_trie::RadixTrie> tries(parts);
+        prefix_trie::RadixTrie whole;
+        for (std::size_t i = 0; i < words.size(); i++) {
+            tries[i * parts / words.size()].insert(words[i]);
+            whole.insert(words[i]);
+            if (i % 97 == 0) { // merge of prefixes of the input too
+                prefix_trie::RadixTrie merged;
+                for (const auto& trie: tries)
+                    merged.merge(trie);
+                ASSERT_EQ(merged.shortest_unique_prefix(), whole.shortest_unique_prefix());
+            }
+        }
+        for (std::size_t i = 1; i < parts; i++)
+            tries[0].merge(tries[i]);
+        ASSERT_EQ(tries[0].shortest_unique_prefix(), whole.shortest_unique_prefix());
+    }
+}
+
+TEST_P(AssignmentTestFromFile, AssignmentExampleStreamInput) {
+    ASSERT_EQ(run_assignment<prefix_runner_t>(GetParam(), [](prefix_runner_t&) {}, mapreduce::InputMode::stream),
+              GetParam().expected_result);
+}
+
+TEST_P(AssignmentTestFromFile, AssignmentExampleRangePartitioner) {
+    using runner_t = mapreduce::MapReduceRunner<prefix::PrefixMapper, prefix::PrefixReducer,
+            mapreduce::FirstByteRangePartitioner>;
+    ASSERT_EQ(run_assignment<runner_t>(GetParam()), GetParam().expected_result);
+}
+
+TEST_P(AssignmentTestFromFile, AssignmentExampleSpillToDisk) {
+    ASSERT_EQ(run_assignment<prefix_runner_t>(GetParam(), [](auto& runner) {
+        runner.set_memory_budget(100); // every few emails are spilled to disk
+    }), GetParam().expected_result);
+}
+
+TEST_P(AssignmentTestFromFile, AssignmentExampleRepeatedWithSharedPool) {
+    auto thread_pool = std::make_shared<mapreduce::ThreadPool>(3);
+    auto task_runner = mapreduce::MapReduceRunner<
+            prefix_optimized::PrefixMapper,
+            prefix_optimized::PrefixReducer>(
+            GetParam().in_file,
+            GetParam().num_threads_map,
+            GetParam().num_threads_reduce);
+    task_runner.set_thread_pool(thread_pool);
+    for (int i = 0; i < 2; i++) {
+        std::vector<int> reduce_results = task_runner.process();
+        auto result = std::max_element(reduce_results.cbegin(), reduce_results.cend());
+        ASSERT_EQ(*result, GetParam().expected_result);
+    }
+}
+
+TEST_P(AssignmentTestFromFile, AssignmentExamplePipelined) {
+    ASSERT_EQ(run_assignment<prefix_runner_t>(GetParam(), [](auto& runner) { runner.set_pipelined(true); }),
+              GetParam().expected_result);
+}
+
+TEST_P(AssignmentTestFromFile, AssignmentExamplePinnedThreads) {
+    ASSERT_EQ(run_assignment<prefix_runner_t>(GetParam(), [](auto& runner) {
+        runner.set_pin_threads(true);
+        runner.set_memory_budget(1024); // map tasks spill their own runs
+    }), GetParam().expected_result);
+}
+
+TEST_P(AssignmentTestFromFile, AssignmentExampleProcesses) {
+    // each map task writes a file for each partition: a few workers are enough
+    mapreduce::TempDirectory directory;
+    mapreduce::ProcessRunner<prefix::PrefixMapper, prefix::PrefixReducer> task_runner(
+            GetParam().in_file, std::min(GetParam().num_threads_map, 4), std::min(GetParam().num_threads_reduce, 4),
+            directory.file(""));
+    task_runner.set_work_path(directory.file(""));
+    for (std::size_t memory_budget: {0, 100}) { // with budget map tasks write several runs of shuffle files
+        task_runner.set_memory_budget(memory_budget);
+        std::vector<int> reduce_results = task_runner.process();
+        auto result = std::max_element(reduce_results.cbegin(), reduce_results.cend());
+        ASSERT_EQ(*result, GetParam().expected_result);
+        ASSERT_EQ(task_runner.failed_attempts_count(), 0u);
+        std::size_t spilled_runs = 0;
+        for (const auto& task_stats: task_runner.stats().map_tasks)
+            spilled_runs += task_stats.spilled_runs;
+        ASSERT_EQ(spilled_runs > 0, memory_budget > 0);
+    }
+}
+
+TEST(ThreadPool, NestedParallelFor) {
+    mapreduce::ThreadPool thread_pool(2);
+    std::vector<std::atomic<int>> counters(10);
+    thread_pool.parallel_for(counters.size(), [&](std::size_t i) {
+        thread_pool.parallel_for(100, [&](std::size_t) {
+            counters[i]++;
+        });
+    });
+    for (const auto& counter: counters)
+        ASSERT_EQ(counter, 100);
+}
+
+TEST(ThreadPool, ExceptionIsRethrown) {
+    mapreduce::ThreadPool thread_pool(2);
+    ASSERT_THROW(thread_pool.parallel_for(10, [](std::size_t i) {
+        if (i == 5)
+            throw std::runtime_error("task failed");
+    }), std::runtime_error);
+}
+
+TEST(ThreadPool, TaskGroupTasksAddTasks) {
+    mapreduce::ThreadPool thread_pool(2);
+    std::atomic<int> counter{0};
+    mapreduce::TaskGroup tasks(thread_pool);
+    std::function<void(int)> spawn = [&](int depth) {
+        counter++;
+        if (depth < 10) {
+            tasks.run([&, depth] { spawn(depth + 1); });
+            tasks.run([&, depth] { spawn(depth + 1); });
+        }
+    };
+    tasks.run([&] { spawn(0); });
+    tasks.wait();
+    ASSERT_EQ(counter, 2047);
+    tasks.run([] { throw std::runtime_error("task failed"); });
+    ASSERT_THROW(tasks.wait(), std::runtime_error);
+}
+
+TEST(ThreadPool, PinnedWorkersRunOnTheirCpus) {
+    ASSERT_EQ(mapreduce::parse_cpu_list("0-3,8,10-11"), (std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    ASSERT_TRUE(mapreduce::parse_cpu_list("").empty());
+
+    auto cpus = mapreduce::cpus_by_node();
+    ASSERT_FALSE(cpus.empty());
+    mapreduce::ThreadPool thread_pool(3, true);
+    std::vector<int> worker_cpus(10, -1), current_cpus(10, -1);
+    thread_pool.parallel_for(worker_cpus.size(), [&](std::size_t i) {
+        auto idx = thread_pool.worker_index();
+        if (idx >= 0) { // not the waiting thread
+            worker_cpus[i] = thread_pool.worker_cpu(idx);
+            current_cpus[i] = sched_getcpu();
+        }
+    });
+    ASSERT_EQ(worker_cpus, current_cpus);
+    ASSERT_EQ(thread_pool.worker_cpu(0), cpus[0]);
+    ASSERT_EQ(thread_pool.pinning_failures(), 0);
+    ASSERT_EQ(mapreduce::ThreadPool(1).worker_cpu(0), -1);
+    // cpu which doesn't exist can't be pinned to
+    ASSERT_FALSE(mapreduce::pin_thread(pthread_self(), CPU_SETSIZE));
+    ASSERT_FALSE(mapreduce::pin_thread(pthread_self(), -1));
+}
+
+TEST(RunnerStats, CountsRecordsAndPairs) {
+    auto task_runner = mapreduce::MapReduceRunner<
+            prefix_no_duplicates::PrefixMapper,
+            prefix_no_duplicates::PrefixReducer,
+            mapreduce::HashPartitioner,
+            prefix_no_duplicates::PrefixCombiner>(
+            PROJECT_SOURCE_DIR + "/test/data/test.mg-no-new-line.in.txt"s, 1, 2);
+    task_runner.set_tasks_per_thread(1);
+    task_runner.process();
+    const auto& stats = task_runner.stats();
+
+    ASSERT_EQ(stats.map_tasks.size(), 1);
+    ASSERT_EQ(stats.map_tasks[0].records, 10);
+    ASSERT_EQ(stats.map_tasks[0].bytes, 50);
+    ASSERT_EQ(stats.map_tasks[0].pairs_emitted, 50); // one pair for each prefix
+    // one map task: combiner leaves one pair for each distinct prefix ("8" and "8s" are shared)
+    ASSERT_EQ(stats.map_tasks[0].pairs_shuffled, 48);
+    ASSERT_EQ(stats.total_keys(), 48);
+    ASSERT_EQ(stats.reduce_tasks.size(), 2);
+    ASSERT_EQ(stats.key_group_histogram, std::vector<std::uint64_t>{stats.total_keys()});
+    ASSERT_GT(stats.peak_rss_bytes, 0);
+}
+
+TEST(StringArena, StoredViewsStayValid) {
+    mapreduce::StringArena arena(8);
+    std::vector<std::string_view> stored;
+    std::vector<std::string> expected{"abc", "defgh", "", "long string which doesn't fit block", "ij"};
+    for (const auto& value: expected)
+        stored.push_back(arena.store(value));
+    ASSERT_EQ(stored, (std::vector<std::string_view>{expected.begin(), expected.end()}));
+    ASSERT_EQ(arena.size(), 45);
+}
+
+TEST(MappedInput, AlignToLineStart) {
+    std::string_view data = "ab\ncd\nef";
+    ASSERT_EQ(mapreduce::align_to_line_start(data, 0), 0);
+    ASSERT_EQ(mapreduce::align_to_line_start(data, 1), 3);
+    ASSERT_EQ(mapreduce::align_to_line_start(data, 3), 3);
+    ASSERT_EQ(mapreduce::align_to_line_start(data, 7), 8);
+    ASSERT_EQ(mapreduce::align_to_line_start(data, 100), data.size());
+}
+
+TEST(MappedInput, AlignStreamToLineStart) {
+    // the same positions as in mapped data, including line longer than one scanned block
+    std::string data = "ab\ncd\n" + std::string(100000, 'x') + "\nef";
+    std::istringstream in(data);
+    for (std::uint64_t position = 0; position <= data.size() + 1; position += position < 100 ? 1 : 997)
+        ASSERT_EQ(mapreduce::align_to_line_start(in, position, data.size()),
+                  mapreduce::align_to_line_start(data, position));
+}
+
+TEST(MappedInput, RecordsAreSplitByWhitespace) {
+    std::string_view data = "ab\r\n  cd\n\nef";
+    std::vector<std::string_view> records;
+    mapreduce::for_each_record(data, 0, data.size(), [&](std::string_view record) {
+        records.push_back(record);
+    });
+    ASSERT_EQ(records, (std::vector<std::string_view>{"ab", "cd", "ef"}));
+}
+
+TEST(SortedRuns, KeyGroupsStreamValues) {
+    using pair_t = std::pair<std::string, int>;
+    std::vector<std::unique_ptr<mapreduce::SortedRun<pair_t>>> runs;
+    runs.emplace_back(std::make_unique<mapreduce::VectorRun<pair_t>>(
+            std::vector<pair_t>{{"a", 1}, {"b", 2}, {"c", 5}}));
+    runs.emplace_back(std::make_unique<mapreduce::VectorRun<pair_t>>(
+            std::vector<pair_t>{{"a", 3}, {"b", 4}}));
+    mapreduce::MergedRuns<pair_t> merged(std::move(runs));
+    mapreduce::KeyGroups<pair_t> groups(merged);
+
+    std::vector<std::pair<std::string, std::vector<int>>> result;
+    while (groups.next_key()) {
+        result.push_back({groups.key(), {}});
+        for (auto value: groups.values()) {
+            result.back().second.push_back(value);
+            if (groups.key() == "b")
+                break; // not read values must be skipped
+        }
+    }
+    ASSERT_EQ(result, (std::vector<std::pair<std::string, std::vector<int>>>{
+            {"a", {1, 3}},
+            {"b", {2}},
+            {"c", {5}}}));
+}
+
+TEST(EmailGenerator, DeterministicWithDuplicatesAndSharedPrefixes) {
+    synthetic::EmailGeneratorOptions options;
+    options.count = 1000;
+    options.shared_prefix_depth = 3;
+    options.duplicate_ratio = 0.5;
+    options.first_letter_skew = 2;
+    std::stringstream first, second;
+    synthetic::EmailGenerator(options).write(first);
+    synthetic::EmailGenerator(options).write(second);
+    ASSERT_EQ(first.str(), second.str());
+
+    std::vector<std::string> emails;
+    std::string email;
+    while (first >> email) {
+        auto local_length = email.find('@');
+        ASSERT_GE(local_length, std::max(options.min_length, options.shared_prefix_depth + 1));
+        ASSERT_LE(local_length, std::max(options.max_length, options.shared_prefix_depth + 1));
+        emails.push_back(email);
+    }
+    ASSERT_EQ(emails.size(), options.count);
+    std::sort(emails.begin(), emails.end());
+    auto num_unique = std::unique(emails.begin(), emails.end()) - emails.begin();
+    ASSERT_GT(num_unique, 400);
+    ASSERT_LT(num_unique, 600);
+}
+
+TEST(Lcp, KernelsMatchScalar) {
+    std::vector<lcp::Kernel> kernels{lcp::common_prefix_words, lcp::best_kernel()};
+#ifdef YAMR_LCP_X86
+    kernels.push_back(lcp::common_prefix_sse2);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(lcp::common_prefix_avx2);
+#endif
+    // mismatch at every position of strings up to 100 bytes, with unaligned starts
+    std::string lhs(120, 'a');
+    for (std::size_t offset = 0; offset < 3; offset++) {
+        for (std::size_t size = 0; size <= 100; size++) {
+            for (std::size_t mismatch = 0; mismatch <= size; mismatch++) {
+                auto rhs = lhs;
+                if (mismatch < size)
+                    rhs[offset + mismatch] = 'b';
+                auto expected = lcp::common_prefix_scalar(lhs.data() + offset, rhs.data() + offset, size);
+                ASSERT_EQ(expected, mismatch);
+                for (auto kernel: kernels)
+                    ASSERT_EQ(kernel(lhs.data() + offset, rhs.data() + offset, size), expected);
+            }
+        }
+    }
+    // strings which end right before inaccessible pages: a load past their ends would crash
+    auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    auto memory = static_cast<char *>(mmap(nullptr, 4 * page, PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(memory, MAP_FAILED);
+    ASSERT_EQ(mprotect(memory + page, page, PROT_NONE), 0);
+    ASSERT_EQ(mprotect(memory + 3 * page, page, PROT_NONE), 0);
+    std::fill_n(memory, page, 'a');
+    std::fill_n(memory + 2 * page, page, 'a');
+    auto lhs_end = memory + page, rhs_end = memory + 3 * page;
+    for (std::size_t size = 0; size <= 100; size++) {
+        for (auto kernel: kernels) {
+            ASSERT_EQ(kernel(lhs_end - size, rhs_end - size, size), size);
+            if (size > 0) {
+                rhs_end[-1] = 'b';
+                ASSERT_EQ(kernel(lhs_end - size, rhs_end - size, size), size - 1);
+                rhs_end[-1] = 'a';
+            }
+        }
+    }
+    munmap(memory, 4 * page);
+
+    ASSERT_EQ(lcp::common_prefix_length("email@gmail.com", "email@gmail.ru"), 12);
+    ASSERT_EQ(lcp::common_prefix_length("same", "same"), 4);
+    ASSERT_EQ(lcp::common_prefix_length("", "abc"), 0);
+}
+
+TEST(StringSort, StableLikeComparisonSort) {
+    // short keys with many duplicates and common prefixes, enough of them for parallel sorting
+    mapreduce::SplitMix64 random(42);
+    std::vector<std::pair<std::string, int>> pairs;
+    for (int i = 0; i < 100000; i++) {
+        std::string key(random.below(6), 'a');
+        for (auto& symbol: key)
+            symbol = static_cast<char>('a' + random.below(3) + (random.below(100) == 0 ? 150 : 0));
+        pairs.emplace_back(key, i);
+    }
+    auto expected = pairs;
+    std::stable_sort(expected.begin(), expected.end(),
+                     [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+    auto sequential = pairs;
+    mapreduce::sort_by_key(sequential);
+    ASSERT_EQ(sequential, expected);
+
+    mapreduce::ThreadPool thread_pool(3);
+    auto parallel = pairs;
+    mapreduce::string_sort(parallel, [](const auto& pair) -> const std::string& { return pair.first; },
+                           &thread_pool);
+    ASSERT_EQ(parallel, expected);
+
+    std::vector<std::string_view> views{"b", "", "ab", "a", "abc", "ab"};
+    mapreduce::string_sort(views);
+    ASSERT_EQ(views, (std::vector<std::string_view>{"", "a", "ab", "ab", "abc", "b"}));
+}
+
+TEST_P(AssignmentTestFromFile, IncrementalAppends) {
+    // file is processed in three runs: it grows by appends between them
+    std::vector<std::string> lines;
+    std::ifstream in(GetParam().in_file);
+    for (std::string line; std::getline(in, line);)
+        lines.push_back(line);
+    mapreduce::TempDirectory directory;
+    auto input = directory.file("input.txt");
+    std::ofstream out(input);
+    std::vector<int> reduce_results;
+    for (int part = 1; part <= 3; part++) {
+        for (auto i = lines.size() * (part - 1) / 3; i < lines.size() * part / 3; i++)
+            out << lines[i] << "\n";
+        out.flush();
+        reduce_results = prefix_incremental::IncrementalPrefixEngine(
+                input, directory.file("state"), GetParam().num_threads_map).process();
+    }
+    ASSERT_EQ(reduce_results, std::vector<int>{GetParam().expected_result});
+}
+
+TEST(PackedPairs, RoundTrip) {
+    std::vector<std::pair<std::string, int>> strings{{"", -1}, {"a", 0}, {"abc", 300}, {"abd", -70000}, {"b", 5}};
+    mapreduce::PackedRun<std::pair<std::string, int>> string_run(mapreduce::pack_pairs(strings));
+    std::vector<std::pair<std::string, int>> unpacked;
+    for (std::pair<std::string, int> elem; string_run.next(elem);)
+        unpacked.push_back(elem);
+    ASSERT_EQ(unpacked, strings);
+
+    // views keep their addresses, key which is a prefix of value takes a few bytes
+    std::string data = "email@gmail.com other@mail.ru";
+    std::string_view view(data);
+    std::vector<std::pair<std::string_view, std::string_view>> views{
+            {view.substr(0, 1), view.substr(0, 15)}, {view.substr(0, 2), view.substr(0, 15)},
+            {view.substr(16, 1), view.substr(16)}, {view.substr(16, 1), view.substr(16, 0)}};
+    auto bytes = mapreduce::pack_pairs(views);
+    ASSERT_LE(bytes.size(), 4 * 8); // 4 * 32 bytes in vector
+    mapreduce::PackedRun<std::pair<std::string_view, std::string_view>> view_run(std::move(bytes));
+    std::pair<std::string_view, std::string_view> elem;
+    for (const auto& expected: views) {
+        ASSERT_TRUE(view_run.next(elem));
+        ASSERT_EQ(elem.first.data(), expected.first.data());
+        ASSERT_EQ(elem.first.size(), expected.first.size());
+        ASSERT_EQ(elem.second.data(), expected.second.data());
+        ASSERT_EQ(elem.second.size(), expected.second.size());
+    }
+    ASSERT_FALSE(view_run.next(elem));
+}
+
+TEST(OutputSink, FileSinkWritesSmallAndBigTexts) {
+    mapreduce::TempDirectory directory;
+    std::string big(5000, 'x');
+    {
+        mapreduce::FileSink sink(directory.file("out.txt"));
+        for (int i = 0; i < 1000; i++)
+            sink.write_line("key" + std::to_string(i));
+        sink.write_line(big);
+        sink.close();
+    }
+    std::ifstream in(directory.file("out.txt"));
+    std::string line;
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_TRUE(std::getline(in, line));
+        ASSERT_EQ(line, "key" + std::to_string(i));
+    }
+    ASSERT_TRUE(std::getline(in, line));
+    ASSERT_EQ(line, big);
+    ASSERT_FALSE(std::getline(in, line));
+
+    // full disk: error of the last block is reported by close()
+    mapreduce::FileSink full("/dev/full");
+    full.write_line("key");
+    ASSERT_THROW(full.close(), std::system_error);
+}
+
+TEST(OutputSink, RunnerOutputFormats) {
+    using runner_t = mapreduce::MapReduceRunner<prefix_optimized::PrefixMapper, prefix_optimized::PrefixReducer>;
+    mapreduce::TempDirectory directory;
+    runner_t none_runner(PROJECT_SOURCE_DIR + "/test/data/test.1.in.txt"s, 2, 2, directory.file("none_"));
+    none_runner.set_output_format(mapreduce::OutputFormat::none);
+    auto none_results = none_runner.process();
+    ASSERT_EQ(*std::max_element(none_results.begin(), none_results.end()), 8);
+
+    runner_t text_runner(PROJECT_SOURCE_DIR + "/test/data/test.1.in.txt"s, 1, 1, directory.file("text_"));
+    text_runner.process(); // one output file per reducer
+
+    std::vector<std::string> files;
+    for (const auto& entry: std::filesystem::directory_iterator(directory.file("")))
+        files.push_back(entry.path().filename().string());
+    ASSERT_EQ(files, std::vector<std::string>{"text_reduce_0.txt"});
+    std::ifstream in(directory.file("text_reduce_0.txt"));
+    std::vector<std::string> keys{std::istream_iterator<std::string>(in), std::istream_iterator<std::string>()};
+    ASSERT_EQ(keys, (std::vector<std::string>{"e", "s", "w"}));
+}
+
+// value of keys which are only counted: takes no bytes in packed runs
+struct Occurrence {
+    bool operator==(const Occurrence&) const {
+        return true;
+    }
+};
+
+// mappers of both kinds: vector of pairs with values which are only counted, and emit callback
+struct WordOccurrenceMapper {
+    std::vector<std::pair<std::string_view, Occurrence>> operator()(const std::string&, std::string_view word) {
+        return {{word, {}}};
+    }
+};
+
+struct WordLengthMapper {
+    using kv_t = std::pair<std::size_t, int>;
+
+    template<typename Emit>
+    void operator()(const std::string&, std::string_view word, Emit& emit) {
+        emit(word.size(), 1);
+    }
+};
+
+// the biggest number of values of a key
+struct MaxCountReducer {
+    static constexpr bool order_insensitive = true;
+
+    explicit MaxCountReducer(mapreduce::OutputSink&) {}
+
+    template<typename Key, typename Values>
+    int operator()(const Key&, Values& values) {
+        int count = 0;
+        for (const auto& value: values) {
+            (void) value;
+            count++;
+        }
+        result = std::max(result, count);
+        return result;
+    }
+
+    int result = 0;
+};
+
+TEST(MapTraits, VectorAndSinkMappers) {
+    static_assert(!mapreduce::MapTraits<WordOccurrenceMapper>::sink);
+    static_assert(mapreduce::MapTraits<WordLengthMapper>::sink);
+    static_assert(mapreduce::MapTraits<prefix::PrefixMapper>::sink);
+    static_assert(mapreduce::ReduceTraits<MaxCountReducer>::order_insensitive);
+
+    mapreduce::TempDirectory directory;
+    auto input = directory.file("words.txt");
+    std::ofstream(input) << "a bb a ccc a bb\nddd\n";
+    mapreduce::MapReduceRunner<WordOccurrenceMapper, MaxCountReducer> occurrences(input, 2, 2, directory.file("w_"));
+    occurrences.set_output_format(mapreduce::OutputFormat::none);
+    auto results = occurrences.process();
+    ASSERT_EQ(*std::max_element(results.begin(), results.end()), 3);
+
+    mapreduce::MapReduceRunner<WordLengthMapper, MaxCountReducer> lengths(input, 1, 1, directory.file("l_"),
+                                                                          mapreduce::InputMode::stream);
+    lengths.set_output_format(mapreduce::OutputFormat::none);
+    lengths.set_memory_budget(1, directory.file("")); // each pair is spilled
+    results = lengths.process();
+    ASSERT_EQ(*std::max_element(results.begin(), results.end()), 3);
+}
+
+// all words of a key in order of input: result depends on order of values
+struct WordsByLengthMapper {
+    using kv_t = std::pair<std::size_t, std::string_view>;
+
+    template<typename Emit>
+    void operator()(const std::string&, std::string_view word, Emit& emit) {
+        emit(word.size(), word);
+    }
+};
+
+struct ConcatReducer {
+    explicit ConcatReducer(mapreduce::OutputSink&) {}
+
+    template<typename Values>
+    std::string operator()(const std::size_t&, Values& values) {
+        std::string result;
+        for (const auto& value: values)
+            result.append(value).append(" ");
+        return result;
+    }
+};
+
+TEST(Pipeline, ValuesKeepOrderOfInput) {
+    mapreduce::TempDirectory directory;
+    auto input = directory.file("words.txt");
+    {
+        std::ofstream out(input);
+        for (int i = 0; i < 3000; i++)
+            out << std::string(1 + i % 7, static_cast<char>('a' + i % 26)) << i << "\n";
+    }
+    auto run = [&](bool pipelined, std::size_t memory_budget) {
+        mapreduce::MapReduceRunner<WordsByLengthMapper, ConcatReducer> runner(input, 8, 3, directory.file("w_"));
+        runner.set_output_format(mapreduce::OutputFormat::none);
+        runner.set_pipelined(pipelined);
+        runner.set_memory_budget(memory_budget, directory.file(""));
+        auto results = runner.process();
+        EXPECT_EQ(runner.stats().phases.back().name, pipelined ? "pipeline" : "reduce");
+        return results;
+    };
+    auto expected = run(false, 0);
+    ASSERT_EQ(run(true, 0), expected);
+    ASSERT_EQ(run(true, 1000), expected); // spilled runs are not merged before reduce
+}
+
+// faults are records of input: "crash:<file>" and "hang:<file>" crash or hang the worker which removes
+// the file (so only the first attempt fails) and emit nothing, "throw" fails every attempt
+struct FaultyMapper : prefix_optimized::PrefixMapper {
+    template<typename Emit>
+    void operator()(const std::string& key, std::string_view record, Emit& emit) {
+        auto fault = record.substr(0, record.find(':'));
+        if (fault == "crash" || fault == "hang") {
+            if (std::remove(std::string(record.substr(fault.size() + 1)).c_str()) == 0) {
+                if (fault == "crash")
+                    std::raise(SIGKILL);
+                std::this_thread::sleep_for(std::chrono::seconds(10)); // until its backup is done and it is killed
+            }
+            return;
+        }
+        if (record == "throw")
+            throw std::runtime_error("bad record");
+        prefix_optimized::PrefixMapper::operator()(key, record, emit);
+    }
+};
+
+// copy of input with a fault record, its marker file is created
+std::string input_with_fault(const mapreduce::TempDirectory& directory, const std::string& input,
+                             const std::string& fault) {
+    auto marker = directory.file(fault);
+    std::ofstream(marker).put('x');
+    auto faulty_input = directory.file(fault + ".txt");
+    std::ofstream out(faulty_input);
+    out << std::ifstream(input).rdbuf() << "\n" << fault << ":" << marker << "\n";
+    return faulty_input;
+}
+
+TEST(ProcessRunner, FailedAndSlowTasksAreExecutedAgain) {
+    using runner_t = mapreduce::ProcessRunner<FaultyMapper, prefix_optimized::PrefixReducer>;
+    mapreduce::TempDirectory directory;
+    mapreduce::TempDirectory input_directory;
+    auto input = PROJECT_SOURCE_DIR + "/test/data/test.1.in.txt"s;
+
+    runner_t crashing(input_with_fault(input_directory, input, "crash"), 2, 2, directory.file("crash_"));
+    auto results = crashing.process();
+    ASSERT_EQ(*std::max_element(results.begin(), results.end()), 8);
+    ASSERT_EQ(crashing.failed_attempts_count(), 1u);
+
+    // the slow attempt is killed when its backup is done, so the run doesn't wait for it
+    runner_t hanging(input_with_fault(input_directory, input, "hang"), 2, 2, directory.file("hang_"));
+    hanging.set_backup_after(0.1);
+    mapreduce::Stopwatch stopwatch;
+    results = hanging.process();
+    ASSERT_EQ(*std::max_element(results.begin(), results.end()), 8);
+    ASSERT_GE(hanging.backup_attempts_count(), 1u);
+    ASSERT_LT(stopwatch.wall_seconds(), 5);
+
+    // output is the same as of threads, no files of attempts are left
+    std::vector<std::string> files;
+    for (const auto& entry: std::filesystem::directory_iterator(directory.file("")))
+        files.push_back(entry.path().filename().string());
+    std::sort(files.begin(), files.end());
+    ASSERT_FALSE(files.empty());
+    ASSERT_EQ(files.size() % 2, 0u);
+    for (std::size_t i = 0; i < files.size() / 2; i++) {
+        ASSERT_EQ(files[i].substr(0, 13), "crash_reduce_");
+        ASSERT_EQ(files[i + files.size() / 2], "hang_" + files[i].substr(6));
+        ASSERT_EQ(files[i].substr(files[i].size() - 4), ".txt");
+    }
+
+    auto bad_input = directory.file("bad.txt");
+    std::ofstream(bad_input) << "a@b.c\nthrow\n";
+    runner_t throwing(bad_input, 1, 1, directory.file("bad_"));
+    throwing.set_max_attempts(2);
+    ASSERT_THROW(throwing.process(), std::runtime_error);
+    ASSERT_EQ(throwing.failed_attempts_count(), 2u);
+}
+
 class AssignmentTestFromFileNoDuplicates : public testing::TestWithParam<TestParams> {
 };
 
@@ -59,6 +779,19 @@ TEST_P(AssignmentTestFromFileNoDuplicates, AssignmentExampleOptimized) {
     ASSERT_EQ(*result, GetParam().expected_result);
 }
 
+TEST_P(AssignmentTestFromFileNoDuplicates, AssignmentExampleWithCombiner) {
+    ASSERT_EQ(run_assignment<combiner_runner_t>(GetParam()), GetParam().expected_result);
+}
+
+TEST_P(AssignmentTestFromFileNoDuplicates, AssignmentExampleWithCombinerSpillToDisk) {
+    ASSERT_EQ(run_assignment<combiner_runner_t>(GetParam(), [](auto& runner) { runner.set_memory_budget(1); }),
+              GetParam().expected_result);
+}
+
+TEST_P(AssignmentTestFromFileNoDuplicates, AssignmentExampleWithCombinerPipelined) {
+    ASSERT_EQ(run_assignment<combiner_runner_t>(GetParam(), [](auto& runner) { runner.set_pipelined(true); }),
+              GetParam().expected_result);
+}
 
 INSTANTIATE_TEST_CASE_P(MyGroup, AssignmentTestFromFile, ::testing::Values(
         TestParams{PROJECT_SOURCE_DIR + "/test/data/test.1.in.txt"s, 1, 1, 8},